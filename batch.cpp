@@ -0,0 +1,87 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gbemuz.hpp"
+
+// gbemuz-batch <rom> [instances] [frames] [threads]
+// runs many independent instances of one rom, a few frames per task. without a thread count it
+// goes through 1, 2, 4 ... threads up to the core count to show how it scales
+
+namespace {
+
+constexpr int frames_per_task = 10;
+
+struct Instance {
+    explicit Instance(std::shared_ptr<const RomImage> image) : gb(std::move(image)) {
+        gb.ppu.set_render(false);
+    }
+
+    GameBoy gb;
+    int frames_left = 0;
+};
+
+void step(ThreadPool& pool, Instance& instance) {
+    int frames = std::min(frames_per_task, instance.frames_left);
+    instance.gb.run(u64(frames * CYCLES_PER_FRAME));
+    instance.frames_left -= frames;
+    if (instance.frames_left > 0)
+        pool.submit([&pool, &instance] { step(pool, instance); });
+}
+
+double run(const std::shared_ptr<const RomImage>& image, size_t count, int frames, size_t threads) {
+    std::vector<std::unique_ptr<Instance>> instances;
+    for (size_t i = 0; i < count; i++)
+        instances.push_back(std::make_unique<Instance>(image));
+
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    for (auto& instance : instances) {
+        instance->frames_left = frames;
+        Instance& i = *instance;
+        pool.submit([&pool, &i] { step(pool, i); });
+    }
+    pool.wait();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return double(count) * frames / elapsed;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <rom> [instances] [frames] [threads]" << std::endl;
+        return 1;
+    }
+
+    auto image = RomImage::open(argv[1]);
+    size_t count = argc > 2 ? std::stoul(argv[2]) : 1000;
+    int frames = argc > 3 ? std::stoi(argv[3]) : 600;
+
+    std::vector<size_t> thread_counts;
+    if (argc > 4) {
+        thread_counts.push_back(std::stoul(argv[4]));
+    } else {
+        size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t t = 1; t < cores; t *= 2)
+            thread_counts.push_back(t);
+        thread_counts.push_back(cores);
+    }
+
+    std::cout << count << " instances, " << frames << " frames each" << std::endl;
+    double single = 0;
+    for (size_t threads : thread_counts) {
+        double rate = run(image, count, frames, threads);
+        if (threads == 1)
+            single = rate;
+
+        std::cout << "  " << threads << " threads: " << rate << " frames/s, " << rate / FRAMERATE << "x real time";
+        if (single)
+            std::cout << ", " << rate / single << "x one thread";
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "definitions.hpp"
+#include "gameboy.hpp"
+#include "link.hpp"
+#include "rom.hpp"
+#include "runahead.hpp"
+
+// gbemuz_bench <rom> [benchmark...], all of them when none is named
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// headless frames per second, with and without drawing the lines
+void frames(const std::string& rom) {
+    constexpr int count = 1200;
+
+    std::cout << "frames: " << count << " frames" << std::endl;
+    for (bool render : {true, false}) {
+        GameBoy gb(rom);
+        gb.ppu.set_render(render);
+
+        auto start = Clock::now();
+        gb.run(u64(count * CYCLES_PER_FRAME));
+        double elapsed = seconds_since(start);
+
+        const TileCache& tiles = gb.mmu.tile_cache();
+        u64 lookups = tiles.hits() + tiles.misses();
+        std::cout << "  " << (render ? "rendered" : "not rendered") << ": " << count / elapsed << " frames/s";
+        if (lookups)
+            std::cout << ", tile cache hits " << 100.0 * tiles.hits() / lookups << "%";
+        std::cout << std::endl;
+    }
+}
+
+// frames per second of the scanline and the fifo ppu on the same rom
+void tiers(const std::string& rom) {
+    constexpr int count = 600;
+
+    std::cout << "tiers: " << count << " frames" << std::endl;
+    for (auto accuracy : {PPU::Accuracy::Scanline, PPU::Accuracy::Fifo}) {
+        GameBoy gb(rom, CPU::Mode::BlockCache, accuracy);
+
+        auto start = Clock::now();
+        gb.run(u64(count * CYCLES_PER_FRAME));
+        double elapsed = seconds_since(start);
+
+        std::cout << "  " << (accuracy == PPU::Accuracy::Fifo ? "fifo" : "scanline") << ": " << count / elapsed
+                  << " frames/s" << std::endl;
+    }
+}
+
+// host frame time for each run-ahead depth against plain emulation
+void runahead(const std::string& rom) {
+    constexpr int frames = 600;
+    double base = 0;
+
+    std::cout << "runahead: " << frames << " host frames" << std::endl;
+    for (size_t depth = 0; depth <= 4; depth++) {
+        GameBoy gb(rom);
+        RunAhead ahead(gb, depth);
+
+        auto start = Clock::now();
+        for (int frame = 0; frame < frames; frame++)
+            ahead.run_frame(frame & 0x10 ? Joypad::A : 0);
+        double per_frame = seconds_since(start) / frames * 1e6;
+        if (!depth)
+            base = per_frame;
+
+        std::cout << "  depth " << depth << ": " << per_frame << " us/frame, " << per_frame / base << "x"
+                  << std::endl;
+    }
+}
+
+// frames per second of a linked pair against two instances running unlinked on their own threads
+void link(const std::string& rom) {
+    constexpr int count = 1200;
+    auto image = RomImage::open(rom);
+    u64 cycles = u64(count * CYCLES_PER_FRAME);
+
+    std::cout << "link: " << count << " frames on each of 2 instances" << std::endl;
+    {
+        GameBoy a(image), b(image);
+
+        auto start = Clock::now();
+        std::thread other([&] { b.run(cycles); });
+        a.run(cycles);
+        other.join();
+        std::cout << "  unlinked: " << 2 * count / seconds_since(start) << " frames/s" << std::endl;
+    }
+    {
+        GameBoy a(image), b(image);
+        LinkCable cable(a, b);
+
+        auto start = Clock::now();
+        cable.run(cycles);
+        std::cout << "  linked: " << 2 * count / seconds_since(start) << " frames/s, " << cable.bytes_exchanged()
+                  << " bytes exchanged" << std::endl;
+    }
+}
+
+// block cache frames per second and how often each fused sequence ran. building with GBEMUZ_FUSION
+// on and off compares the speed, the hits show which sequences are worth fusing for a rom
+void fusion(const std::string& rom) {
+    constexpr int count = 1200;
+    constexpr const char* names[] = {"none", "copy", "copy inc", "poll", "countdown"};
+
+    GameBoy gb(rom, CPU::Mode::BlockCache);
+    gb.ppu.set_render(false);
+
+    auto start = Clock::now();
+    gb.run(u64(count * CYCLES_PER_FRAME));
+    double elapsed = seconds_since(start);
+
+    std::cout << "fusion: " << count << " frames, " << (GBEMUZ_FUSION ? "fused" : "not fused") << ": "
+              << count / elapsed << " frames/s" << std::endl;
+    const auto& hits = gb.cpu.fusion_hits();
+    for (size_t i = 1; i < hits.size(); i++)
+        std::cout << "  " << names[i] << ": " << hits[i] << std::endl;
+}
+
+// input is op << 17 | carry << 16 | a << 8 | n, op 0 add / adc 1 sub / sbc / cp 2 daa with n as f
+template<bool tables>
+u16 alu_op(u32 in) {
+    u8 a = in >> 8, n = in;
+    bool carry = in >> 16 & 1;
+    switch (in >> 17) {
+        case 0: return CPU::alu_flags<false, tables>(a, n, carry);
+        case 1: return CPU::alu_flags<true, tables>(a, n, carry);
+        default: return CPU::daa_result<tables>(a, n & 0x70);
+    }
+}
+
+// the cpu's flags of add / adc / sub / sbc / cp and daa worked out with the bit helpers against looked
+// up in the alu tables, on random operands. the rom is not used. GBEMUZ_ALU_TABLES picks the one the
+// cpu runs, building with it on and off compares the two on whole games
+void alu(const std::string&) {
+    constexpr int passes = 200;
+    std::vector<u32> inputs(1 << 16);
+    std::mt19937 rng(1);
+    for (u32& in : inputs)
+        in = rng() % 3 << 17 | (rng() & 0x1ffff);
+
+    std::cout << "alu: " << passes << " x " << inputs.size() << " ops, the cpu uses "
+              << (GBEMUZ_ALU_TABLES ? "tables" : "helpers") << std::endl;
+    std::vector<u16> results[2] = {std::vector<u16>(inputs.size()), std::vector<u16>(inputs.size())};
+    for (int way = 0; way < 2; way++) {
+        auto start = Clock::now();
+        for (int pass = 0; pass < passes; pass++)
+            for (size_t i = 0; i < inputs.size(); i++)
+                results[way][i] = way ? alu_op<true>(inputs[i]) : alu_op<false>(inputs[i]);
+        double ns = seconds_since(start) * 1e9 / (double(passes) * inputs.size());
+        std::cout << "  " << (way ? "tables" : "helpers") << ": " << ns << " ns/op" << std::endl;
+    }
+
+    size_t differ = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
+        differ += results[0][i] != results[1][i];
+    if (differ)
+        std::cout << "  " << differ << " results differ" << std::endl;
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)(const std::string& rom);
+};
+
+constexpr Benchmark benchmarks[] = {
+    {"alu", alu},
+    {"frames", frames},
+    {"fusion", fusion},
+    {"link", link},
+    {"runahead", runahead},
+    {"tiers", tiers},
+};
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <rom> [benchmark...]" << std::endl;
+        return 1;
+    }
+
+    for (const Benchmark& benchmark : benchmarks) {
+        bool selected = argc == 2;
+        for (int i = 2; i < argc; i++)
+            selected |= std::strcmp(argv[i], benchmark.name) == 0;
+        if (selected)
+            benchmark.run(argv[1]);
+    }
+
+    return 0;
+}
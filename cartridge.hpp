@@ -1,44 +1,369 @@
 #pragma once
-#include <fstream>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
 #include <vector>
+#include "definitions.hpp"
+#include "rom.hpp"
+#include "save.hpp"
 
 class Cartrigde {
+public:
+    enum class Mbc { None, Mbc1, Mbc3, Mbc5 };
+
 private:
-    std::vector<u8> rom;
+    std::shared_ptr<const RomImage> rom;
+    Mbc mbc = Mbc::None;
+    bool has_rtc = false;
+    bool battery = false;
+
+    // external ram, in save_file when battery backed and a save path was given
+    u8* ram = nullptr;
+    size_t ram_size = 0;
+    std::vector<u8> ram_buffer;
+    std::unique_ptr<SaveFile> save_file;
+
+    size_t rom_banks = 2;
+    u16 rom_bank = 1; // mapped at 0x4000
+    u16 low_bank = 0; // mapped at 0x0000, only mbc1 mode 1 moves it
+    u8 ram_bank = 0; // 0x08 - 0x0c select an rtc register on mbc3
+    bool ram_enabled = false;
+
+    // mbc1
+    u8 bank_low = 1;
+    u8 bank_high = 0;
+    bool advanced_mode = false;
+
+    // mbc3 rtc, counted in emulated cycles so it keeps time with the rest of the machine, states and
+    // fast forwarding included. the host clock only comes in for the time a battery save sat on disk.
+    // regs are s, m, h, day low, day high
+    std::array<u8, 5> rtc_latched{};
+    s64 rtc_base = 0; // cycle the clock read 0 at
+    s64 rtc_halted_at = 0;
+    bool rtc_halted = false;
+    u8 latch_write = 0xff;
+    const u64* clock = nullptr; // cycles, see set_clock
+
+    // after the ram in a save file, the layout most emulators use: the registers running and latched
+    // as 32 bit words, then the unix time they were written at, all little endian
+    static constexpr size_t rtc_footer = 48;
 
 public:
-    explicit Cartrigde(const std::string& filepath) : rom(load_file(filepath)) {
+    // battery ram is kept next to the rom, game.gb saves to game.sav
+    explicit Cartrigde(const std::string& filepath) : Cartrigde(RomImage::open(filepath), save_path(filepath)) {
     }
 
-    static std::vector<u8> load_file(const std::string& filepath) {
-        std::ifstream ifs(filepath, std::ios::binary|std::ios::ate);
+    // without a save path battery ram only lives in memory
+    explicit Cartrigde(std::shared_ptr<const RomImage> image, const std::string& save_path = {})
+        : rom(std::move(image)) {
+        detect();
 
-        if(!ifs)
-            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+        if (battery && (ram_size || has_rtc) && !save_path.empty()) {
+            save_file = std::make_unique<SaveFile>(save_path, ram_size + (has_rtc ? rtc_footer : 0));
+            ram = save_file->data();
+            if (has_rtc)
+                restore_rtc();
+        } else {
+            ram_buffer.assign(ram_size, 0);
+            ram = ram_buffer.data();
+        }
+    }
 
-        auto end = ifs.tellg();
-        ifs.seekg(0, std::ios::beg);
+    Cartrigde(const Cartrigde&) = delete;
+    Cartrigde& operator=(const Cartrigde&) = delete;
 
-        auto size = std::size_t(end - ifs.tellg());
+    u8 read(u16 address) const {
+        const u8* page = rom_page(address >> 8);
+        return page ? page[address & 0xff] : 0xff;
+    }
 
-        if(size == 0) // avoid undefined behavior
-            return {};
+    // 256 bytes of rom as seen at page << 8, nullptr past the end of the image
+    const u8* rom_page(u8 page) const {
+        size_t bank = page < 0x40 ? low_bank : rom_bank;
+        size_t offset = bank * 0x4000 + ((page & 0x3f) << 8);
+        return offset + 0x100 <= rom->size() ? rom->data() + offset : nullptr;
+    }
+
+    // 256 bytes of external ram at page << 8 (0xa0 - 0xbf), nullptr when disabled or showing the rtc
+    u8* ram_page(u8 page) {
+        if (!ram_enabled || !ram_size || (mbc == Mbc::Mbc3 && ram_bank > 3))
+            return nullptr;
+
+        size_t offset = (ram_bank * 0x2000 + ((page - 0xa0) << 8)) % ram_size;
+        return offset + 0x100 <= ram_size ? ram + offset : nullptr;
+    }
+
+    // writes to a save file have to come through write_ram to be marked dirty
+    u8* ram_write_page(u8 page) { return save_file ? nullptr : ram_page(page); }
 
-        std::vector<u8> buffer(size);
+    // what the slow path sees when ram_page has nothing
+    u8 read_ram(u16 address) const {
+        if (ram_enabled && mbc == Mbc::Mbc3 && has_rtc && ram_bank >= 0x08 && ram_bank <= 0x0c)
+            return rtc_latched[ram_bank - 0x08];
+        if (ram_enabled && ram_size)
+            return ram[ram_offset(address)];
+        return 0xff;
+    }
 
-        if(!ifs.read((char*)buffer.data(), buffer.size()))
-            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+    void write_ram(u16 address, u8 value) {
+        if (ram_enabled && mbc == Mbc::Mbc3 && has_rtc && ram_bank >= 0x08 && ram_bank <= 0x0c)
+            write_rtc(ram_bank - 0x08, value);
+        else if (ram_enabled && save_file)
+            save_file->write(ram_offset(address), value);
+        else if (ram_enabled && ram_size)
+            ram[ram_offset(address)] = value;
+    }
 
-        return buffer;
+    // hands the pages written since the last flush to the os, sync waits for them to reach the disk
+    void flush(bool sync = false) {
+        if (!save_file)
+            return;
+        if (has_rtc)
+            store_rtc();
+        save_file->flush(sync);
     }
 
-    u8 read(u16 address) const { return rom[address]; }
+    // cycles for the rtc to count, the scheduler clock. without one it stands still
+    void set_clock(const u64* cycles) { clock = cycles; }
 
+    bool has_save() const { return save_file != nullptr; }
+
+    // bank registers and rtc, the ram itself is as large as ram_bytes() says and saved next to it
+    struct State {
+        u16 rom_bank;
+        u16 low_bank;
+        u8 ram_bank;
+        bool ram_enabled;
+        u8 bank_low;
+        u8 bank_high;
+        bool advanced_mode;
+        bool rtc_halted;
+        u8 latch_write;
+        std::array<u8, 5> rtc_latched;
+        s64 rtc_base;
+        s64 rtc_halted_at;
+    };
+
+    size_t ram_bytes() const { return ram_size; }
+
+    void save(State& state, u8* ram_copy) const {
+        state = {rom_bank, low_bank, ram_bank, ram_enabled, bank_low, bank_high, advanced_mode, rtc_halted,
+                 latch_write, rtc_latched, rtc_base, rtc_halted_at};
+        std::memcpy(ram_copy, ram, ram_size);
+    }
+
+    // the caller maps the banks again
+    void load(const State& state, const u8* ram_copy) {
+        rom_bank = state.rom_bank % rom_banks;
+        low_bank = state.low_bank % rom_banks;
+        ram_bank = state.ram_bank;
+        ram_enabled = state.ram_enabled;
+        bank_low = state.bank_low;
+        bank_high = state.bank_high;
+        advanced_mode = state.advanced_mode;
+        rtc_halted = state.rtc_halted;
+        latch_write = state.latch_write;
+        rtc_latched = state.rtc_latched;
+        rtc_base = state.rtc_base;
+        rtc_halted_at = state.rtc_halted_at;
+
+        if (std::memcmp(ram, ram_copy, ram_size) == 0) // saves only get dirty when something changed
+            return;
+        std::memcpy(ram, ram_copy, ram_size);
+        if (save_file)
+            save_file->mark(0, ram_size);
+    }
+
+    // global checksum from the header, tells states of different roms apart
+    u16 checksum() const {
+        return rom->size() < 0x150 ? 0 : (rom->data()[0x14e] << 8) | rom->data()[0x14f];
+    }
+
+    // rom itself is never written, writes set the bank controller registers. the caller remaps
+    // rom_page / ram_page afterwards
     void write(u16 address, u8 value) {
-        rom[address] = value;
+        switch (mbc) {
+            case Mbc::None:
+                break;
+            case Mbc::Mbc1:
+                write_mbc1(address, value);
+                break;
+            case Mbc::Mbc3:
+                write_mbc3(address, value);
+                break;
+            case Mbc::Mbc5:
+                write_mbc5(address, value);
+                break;
+        }
+    }
+
+    // bank mapped at address, rom or external ram
+    u16 bank(u16 address) const {
+        if (address < 0x4000)
+            return low_bank;
+        if (address < 0x8000)
+            return rom_bank;
+        return ram_bank;
     }
 
+    Mbc controller() const { return mbc; }
+    size_t rom_bank_count() const { return rom_banks; }
+    bool has_battery() const { return battery; }
+
     std::string title() const {
-        return {rom.begin() + 0x134, rom.begin() + 0x142};
+        if (rom->size() < 0x143)
+            return {};
+        return {rom->data() + 0x134, rom->data() + 0x142};
+    }
+
+    const std::shared_ptr<const RomImage>& image() const { return rom; }
+
+private:
+    static std::string save_path(const std::string& filepath) {
+        size_t dot = filepath.find_last_of('.');
+        size_t slash = filepath.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return filepath + ".sav";
+        return filepath.substr(0, dot) + ".sav";
+    }
+
+    size_t ram_offset(u16 address) const { return (ram_bank * 0x2000 + address - 0xa000) % ram_size; }
+
+    void detect() {
+        rom_banks = std::max<size_t>(2, rom->size() / 0x4000);
+        if (rom->size() < 0x150)
+            return;
+
+        u8 type = rom->data()[0x147];
+        switch (type) {
+            case 0x01 ... 0x03: mbc = Mbc::Mbc1; break;
+            case 0x0f ... 0x13: mbc = Mbc::Mbc3; break;
+            case 0x19 ... 0x1e: mbc = Mbc::Mbc5; break;
+            default: break;
+        }
+        has_rtc = type == 0x0f || type == 0x10;
+        battery = type == 0x03 || type == 0x09 || type == 0x0f || type == 0x10 || type == 0x13 || type == 0x1b
+            || type == 0x1e;
+
+        static constexpr size_t ram_sizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+        u8 size = rom->data()[0x149];
+        ram_size = size < 6 ? ram_sizes[size] : 0;
+        if (type == 0x08 || type == 0x09) // no controller, ram always there
+            ram_enabled = true;
+    }
+
+    void write_mbc1(u16 address, u8 value) {
+        switch (address >> 13) {
+            case 0: ram_enabled = (value & 0x0f) == 0x0a; break;
+            case 1: bank_low = (value & 0x1f) ? value & 0x1f : 1; break;
+            case 2: bank_high = value & 3; break;
+            default: advanced_mode = value & 1; break;
+        }
+
+        rom_bank = ((bank_high << 5) | bank_low) % rom_banks;
+        low_bank = advanced_mode ? (bank_high << 5) % rom_banks : 0;
+        ram_bank = advanced_mode ? bank_high : 0;
+    }
+
+    void write_mbc3(u16 address, u8 value) {
+        switch (address >> 13) {
+            case 0:
+                ram_enabled = (value & 0x0f) == 0x0a;
+                break;
+            case 1:
+                rom_bank = ((value & 0x7f) ? value & 0x7f : 1) % rom_banks;
+                break;
+            case 2:
+                ram_bank = value & 0x0f;
+                break;
+            default:
+                if (latch_write == 0 && value == 1)
+                    latch_rtc();
+                latch_write = value;
+                break;
+        }
+    }
+
+    void write_mbc5(u16 address, u8 value) {
+        switch (address >> 12) {
+            case 0: case 1: ram_enabled = (value & 0x0f) == 0x0a; break;
+            case 2: rom_bank = ((rom_bank & 0x100) | value) % rom_banks; break;
+            case 3: rom_bank = ((rom_bank & 0xff) | ((value & 1) << 8)) % rom_banks; break;
+            case 4: case 5: ram_bank = value & 0x0f; break;
+            default: break;
+        }
+    }
+
+    s64 now() const { return clock ? static_cast<s64>(*clock) : 0; }
+
+    s64 rtc_seconds() const { return ((rtc_halted ? rtc_halted_at : now()) - rtc_base) / s64(CLOCK_FREQUENCY); }
+
+    // the registers as they read right now
+    std::array<u8, 5> rtc_registers() const {
+        s64 t = rtc_seconds();
+        s64 days = t / 86400;
+        return {static_cast<u8>(t % 60), static_cast<u8>(t / 60 % 60), static_cast<u8>(t / 3600 % 24),
+                static_cast<u8>(days & 0xff),
+                static_cast<u8>(((days >> 8) & 1) | (rtc_halted ? 0x40 : 0) | (days > 0x1ff ? 0x80 : 0))};
+    }
+
+    void latch_rtc() { rtc_latched = rtc_registers(); }
+
+    // moves the base so the clock reads back r from now on
+    void set_rtc(const std::array<u8, 5>& r) {
+        s64 days = r[3] | ((r[4] & 1) << 8) | (r[4] & 0x80 ? 0x200 : 0);
+        s64 t = r[0] + r[1] * 60 + r[2] * 3600 + days * 86400;
+
+        rtc_halted_at = now();
+        rtc_base = now() - t * s64(CLOCK_FREQUENCY);
+        rtc_halted = r[4] & 0x40;
+    }
+
+    void write_rtc(u8 reg, u8 value) {
+        latch_rtc();
+        rtc_latched[reg] = value;
+        set_rtc(rtc_latched);
+    }
+
+    void store_rtc() {
+        u8* footer = save_file->data() + ram_size;
+        auto running = rtc_registers();
+        for (int i = 0; i < 5; i++) {
+            put(footer + 4 * i, running[i], 4);
+            put(footer + 20 + 4 * i, rtc_latched[i], 4);
+        }
+        put(footer + 40, static_cast<u64>(std::time(nullptr)), 8);
+        save_file->mark(ram_size, rtc_footer);
+    }
+
+    // a save file without the footer, or a new one, leaves the clock at 0
+    void restore_rtc() {
+        const u8* footer = save_file->data() + ram_size;
+        auto saved_at = static_cast<s64>(get(footer + 40, 8));
+        if (!saved_at)
+            return;
+
+        std::array<u8, 5> running;
+        for (int i = 0; i < 5; i++) {
+            running[i] = get(footer + 4 * i, 4);
+            rtc_latched[i] = get(footer + 20 + 4 * i, 4);
+        }
+        set_rtc(running);
+        if (!rtc_halted) // went on while nothing ran
+            rtc_base -= std::max<s64>(0, std::time(nullptr) - saved_at) * s64(CLOCK_FREQUENCY);
+    }
+
+    static void put(u8* p, u64 value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            p[i] = value >> (8 * i);
+    }
+
+    static u64 get(const u8* p, int bytes) {
+        u64 value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= u64(p[i]) << (8 * i);
+        return value;
     }
 };
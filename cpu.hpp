@@ -1,7 +1,46 @@
 #pragma once
+#include <array>
 #include <memory>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+#include "jit.hpp"
 #include "mmu.hpp"
+#include "scheduler.hpp"
+
+// count instructions and cycles per opcode, address and call stack, see Profiler. nothing of it is
+// built in otherwise
+#ifndef GBEMUZ_PROFILE
+#define GBEMUZ_PROFILE 0
+#endif
+
+#if GBEMUZ_PROFILE
+#include "profiler.hpp"
+#endif
+
+// keep the last alu op instead of setting Z N H C, and work them out only when something reads them
+#ifndef GBEMUZ_LAZY_FLAGS
+#define GBEMUZ_LAZY_FLAGS 0
+#endif
+
+// the eager 8 bit add / subtract and daa look their result and flags up instead of working them out
+#ifndef GBEMUZ_ALU_TABLES
+#define GBEMUZ_ALU_TABLES 1
+#endif
+
+// the block decoder marks a few common sequences to run as one, see fuse
+#ifndef GBEMUZ_FUSION
+#define GBEMUZ_FUSION 1
+#endif
+
+// the interpreter jumps from one handler straight to the next through a label table, gcc and clang only
+#ifndef GBEMUZ_THREADED
+#if defined(__GNUC__)
+#define GBEMUZ_THREADED 1
+#else
+#define GBEMUZ_THREADED 0
+#endif
+#endif
 
 struct Registers {
     struct {
@@ -55,21 +94,334 @@ enum class Flag {
     Carry = 1 << 4,
 };
 
+// clock cycles per opcode with branches not taken, the handlers return whatever a taken one adds
+inline constexpr std::array<u8, 256> regular_cycles = [] {
+    std::array<u8, 256> t{};
+    for (int op = 0; op < 256; op++) {
+        int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+        u8 c = 4;
+        if (x == 0) {
+            if (z == 0)
+                c = y == 1 ? 20 : y == 3 ? 12 : y >= 4 ? 8 : 4;
+            else if (z == 1)
+                c = q ? 8 : 12;
+            else if (z == 2 || z == 3)
+                c = 8;
+            else if (z == 4 || z == 5)
+                c = y == 6 ? 12 : 4;
+            else if (z == 6)
+                c = y == 6 ? 12 : 8;
+        } else if (x == 1) {
+            c = (y == 6) != (z == 6) ? 8 : 4;
+        } else if (x == 2) {
+            c = z == 6 ? 8 : 4;
+        } else {
+            switch (z) {
+                case 0: c = y < 4 ? 8 : y == 5 ? 16 : 12; break;
+                case 1: c = !q ? 12 : p == 2 ? 4 : p == 3 ? 8 : 16; break;
+                case 2: c = y < 4 ? 12 : (y & 1) ? 16 : 8; break;
+                case 3: c = y == 0 ? 16 : 4; break;
+                case 4: c = y < 4 ? 12 : 4; break;
+                case 5: c = !q ? 16 : y == 1 ? 24 : 4; break;
+                case 6: c = 8; break;
+                case 7: c = 16; break;
+            }
+        }
+        t[op] = c;
+    }
+    return t;
+}();
+
+// including the 0xcb fetch
+inline constexpr std::array<u8, 256> prefixed_cycles = [] {
+    std::array<u8, 256> t{};
+    for (int op = 0; op < 256; op++)
+        t[op] = (op & 7) != 6 ? 8 : (op >> 6) == 1 ? 12 : 16;
+    return t;
+}();
+
+// result | f << 8 of a + n + carry
+constexpr u16 add_entry(unsigned a, unsigned n, unsigned carry) {
+    unsigned x = a + n + carry;
+    return static_cast<u16>((x & 0xff) | ((x & 0xff ? 0 : 0x80) | ((a ^ n ^ x) & 0x10) << 1 | (x & 0x100) >> 4) << 8);
+}
+
+// result | f << 8 of daa, n stays as it was
+constexpr u16 daa_entry(u8 a, u8 f) {
+    bool n = f & 0x40, h = f & 0x20, c = f & 0x10;
+    int correction = c ? 0x60 : 0;
+    if (h || (!n && (a & 0xf) > 9))
+        correction |= 0x06;
+    if (c || (!n && a > 0x99))
+        correction |= 0x60;
+
+    u8 result = static_cast<u8>(n ? a - correction : a + correction);
+    int flags = (result ? 0 : 0x80) | (f & 0x40) | ((correction << 2) & 0x100 ? 0x10 : 0);
+    return static_cast<u16>(result | flags << 8);
+}
+
+// not constexpr on purpose, see add_table
+inline std::array<u16, 0x20000> fill_add_table() {
+    std::array<u16, 0x20000> t;
+    for (unsigned i = 0; i < 0x20000; i++)
+        t[i] = add_entry((i >> 8) & 0xff, i & 0xff, i >> 16);
+    return t;
+}
+
+// indexed by carry << 16 | a << 8 | n. a - n - carry is a + ~n + !carry with N H C flipped, so
+// sub sbc and cp look up the same table. filled once at startup: worked out at compile time, every
+// translation unit including this spent seconds on it and carried its own 256k copy until the link.
+// a template so only builds using it have one
+template<typename = void>
+inline const std::array<u16, 0x20000> add_table = fill_add_table();
+
+// indexed by n h c << 8 | a
+inline constexpr std::array<u16, 0x800> daa_table = [] {
+    std::array<u16, 0x800> t{};
+    for (int i = 0; i < 0x800; i++)
+        t[i] = daa_entry(i, (i >> 8) << 4);
+    return t;
+}();
+
 class CPU {
 public:
-    explicit CPU(MMU& mmu) : mmu(mmu) {}
+    enum class Mode {
+        Interpreter,
+        BlockCache, // run decoded straight-line blocks, one block per step
+        Jit, // block cache, with hot rom blocks translated to x86-64
+    };
+
+    CPU(MMU& mmu, Scheduler& scheduler, Mode mode = Mode::Interpreter) : mmu(mmu), scheduler(scheduler) {
+        set_mode(mode);
+    }
+
+    // runs until the clock reaches until or the next event is due, whichever comes first. halted
+    // with nothing pending, the clock jumps to the next event. polling loops are found when a
+    // block is decoded, so they are only skipped in BlockCache and Jit mode, the interpreter
+    // runs them out
+    void run(u64 until) {
+        while (scheduler.now < until && scheduler.now < scheduler.deadline()) {
+            limit = std::min(until, scheduler.deadline());
+#if GBEMUZ_THREADED
+            if (mode != Mode::Interpreter || !run_threaded(limit))
+#endif
+                scheduler.now += step();
+
+            if (skipping && (idle_period || halted) && !mmu.pending_interrupts())
+                fast_forward(std::min(until, scheduler.deadline()));
+            idle_period = 0;
+        }
+        limit = 0; // a step() on its own goes around a countdown once
+    }
+
+    // cycles skipped by fast_forward so far
+    u64 skipped_cycles() const { return skipped; }
+
+    // off, halt and idle loops run instruction by instruction, to the same end
+    void set_fast_forward(bool on) { skipping = on; }
+
+    struct State {
+        Registers registers;
+        bool halted;
+        bool interrupt_enabled;
+        bool enable_interrupts;
+    };
+
+    void save(State& state) const {
+        state.registers = registers;
+        state.registers.f = flags();
+        state.halted = halted;
+        state.interrupt_enabled = interrupt_enabled;
+        state.enable_interrupts = enable_interrupts;
+    }
+
+    // decoded blocks stay, the mmu bumping its page versions on load takes care of stale ones
+    void load(const State& state) {
+        registers = state.registers;
+        lazy.op = FlagOp::None;
+        halted = state.halted;
+        interrupt_enabled = state.interrupt_enabled;
+        enable_interrupts = state.enable_interrupts;
+        idle_period = 0;
+        prefetched = nullptr;
+#if GBEMUZ_PROFILE
+        profile.unwind(); // the call stack it was in is gone
+#endif
+    }
 
     size_t step() {
-        // TODO handle interrupts
+        if (u8 pending = mmu.pending_interrupts()) {
+            halted = false;
+            if (interrupt_enabled)
+                return interrupt(pending);
+        }
 
-        if (halted) { return 4; } else { return exec(); }
+        if (halted) {
+#if GBEMUZ_PROFILE
+            profile.idle(4);
+#endif
+            return 4;
+        }
+
+        if (enable_interrupts) { // ei takes effect after the next instruction
+            enable_interrupts = false;
+            size_t cycles = exec();
+            interrupt_enabled = true;
+            return cycles;
+        }
+
+        if (mode == Mode::BlockCache)
+            return exec_block();
+
+#if GBEMUZ_JIT
+        if (mode == Mode::Jit)
+            return exec_jit();
+#endif
+
+        return exec();
+    }
+
+    // sequences the block decoder runs as one
+    enum class Fusion : u8 {
+        None,
+        Copy, // ld a, (hl+)  ld (de), a  dec bc
+        CopyInc, // ld a, (hl+)  ld (de), a  inc de  dec bc, the usual way round
+        Poll, // ldh a, (n)  cp n  jr nz
+        Countdown, // dec r  jr nz, going around up to the next event when it jumps back to the dec
+        Count,
+    };
+
+    // times each fused sequence ran, a countdown counts every time around
+    const std::array<u64, static_cast<size_t>(Fusion::Count)>& fusion_hits() const { return fused; }
+
+#if GBEMUZ_JIT
+    // blocks running as translated code, and the executable memory they take
+    size_t translated_blocks() const {
+        size_t n = 0;
+        for (const auto& [key, block] : blocks)
+            n += block.native != nullptr;
+        return n;
+    }
+
+    size_t code_memory() const { return arena.reserved(); }
+#endif
+
+#if GBEMUZ_PROFILE
+    Profiler& profiler() { return profile; }
+    const Profiler& profiler() const { return profile; }
+#endif
+
+    // translated code runs past the profiler, so a profiling build falls back to the block cache
+    void set_mode(Mode m) {
+#if GBEMUZ_JIT && !GBEMUZ_PROFILE
+        mode = m == Mode::Jit && !arena.usable() ? Mode::BlockCache : m;
+#else
+        mode = m == Mode::Jit ? Mode::BlockCache : m;
+#endif
+    }
+
+    // f after a + n + carry, or a - n - carry when subtracting, looked up in add_table or worked out
+    // with the bit helpers. GBEMUZ_ALU_TABLES picks the one the cpu runs, the bench times both
+    template<bool subtract, bool tables = GBEMUZ_ALU_TABLES>
+    static u8 alu_flags(u8 a, u8 n, bool carry) {
+        if constexpr (tables && subtract)
+            return (add_table<>[!carry << 16 | a << 8 | static_cast<u8>(~n)] >> 8) ^ 0x70;
+        else if constexpr (tables)
+            return add_table<>[carry << 16 | a << 8 | n] >> 8;
+        else if constexpr (subtract)
+            return flag(Flag::Zero, static_cast<u8>(a - n - carry) == 0) | flag(Flag::Negative, true)
+                   | flag(Flag::HalfCarry, is_no_borrow_from_bit(4, a, n, carry))
+                   | flag(Flag::Carry, is_no_borrow_from_bit(8, a, n, carry));
+        else
+            return flag(Flag::Zero, static_cast<u8>(a + n + carry) == 0)
+                   | flag(Flag::HalfCarry, is_carry_from_bit(3, a, n, carry))
+                   | flag(Flag::Carry, is_carry_from_bit(7, a, n, carry));
+    }
+
+    // a | f << 8 after daa, the same two ways
+    template<bool tables = GBEMUZ_ALU_TABLES>
+    static u16 daa_result(u8 a, u8 f) {
+        if constexpr (tables)
+            return daa_table[(f & 0x70) << 4 | a];
+
+        bool negative = f & static_cast<u8>(Flag::Negative);
+        u16 correction = f & static_cast<u8>(Flag::Carry) ? 0x60 : 0x00;
+
+        if (f & static_cast<u8>(Flag::HalfCarry) || (!negative && ((a & 0x0F) > 9)))
+            correction |= 0x06;
+
+        if (f & static_cast<u8>(Flag::Carry) || (!negative && (a > 0x99)))
+            correction |= 0x60;
+
+        u8 result = static_cast<u8>(negative ? a - correction : a + correction);
+        f = flag(Flag::Zero, result == 0) | flag(Flag::Negative, negative)
+            | flag(Flag::Carry, ((correction << 2) & 0x100) != 0);
+        return static_cast<u16>(result | f << 8);
     }
 
 private:
+    static constexpr bool lazy_flags = GBEMUZ_LAZY_FLAGS;
+    static constexpr bool fusion = GBEMUZ_FUSION;
+
+    // what set the flags last. f is only up to date for None, inc and dec take C from it
+    enum class FlagOp : u8 {
+        None,
+        Add, // add adc
+        Sub, // sub sbc cp
+        And,
+        Or, // or xor
+        Inc,
+        Dec,
+        Rot, // C in bit 8 of the result
+        RotA, // rlca rrca rla rra, which clear Z
+    };
+
+    struct LazyFlags {
+        FlagOp op = FlagOp::None;
+        u8 operands = 0; // x ^ y, H is bit 4 of that ^ result
+        u16 result = 0; // 9 bits wide, bit 8 is C
+    };
+
+    using Handler = size_t (CPU::*)(); // returns the cycles taken
+    using Native = size_t (*)(CPU*, Registers*, const u8*);
+
+    struct Decoded {
+        Handler handler;
+        u8 operands[2]; // immediates, fed to read_u8 instead of fetching them
+        u8 opcode; // the one after 0xcb when prefixed
+        u8 opcode_length; // 1, or 2 when cb prefixed
+        Fusion fusion; // on the first instruction of a fused sequence
+    };
+
+    struct Block {
+        std::vector<Decoded> code;
+        u32 version; // mmu page version when decoded, blocks never leave their page
+        bool idle = false; // see idle_loop
+        u32 hits = 0;
+        Native native = nullptr;
+    };
+
     Registers registers{0xb0, 0x01, 0x13, 0, 0xd8, 0, 0x4D, 0x01, 0xfffe, 0x100};
     MMU& mmu;
+    Scheduler& scheduler;
+    Mode mode;
     bool halted = false;
-    bool interrupt_enabled = true;
+    bool interrupt_enabled = false;
+    bool enable_interrupts = false;
+    size_t idle_period = 0; // cycles of the idle loop that just went around, if any
+    u64 limit = 0; // where run() stops this time round, a countdown goes no further
+    std::array<u64, static_cast<size_t>(Fusion::Count)> fused{};
+    u64 skipped = 0;
+    bool skipping = true;
+    std::unordered_map<u32, Block> blocks; // (bank << 16) | pc
+    const u8* prefetched = nullptr;
+    LazyFlags lazy;
+#if GBEMUZ_JIT
+    CodeArena arena;
+#endif
+#if GBEMUZ_PROFILE
+    Profiler profile{mmu.rom_banks()};
+#endif
 
     void print_debug(u8 op) const {
         // std::setw(2) << std::setfill('0')
@@ -81,7 +433,7 @@ private:
         << " D: " << (uint) registers.d << std::endl;
         std::cout
         << "E: " << (uint) registers.e
-        << " F: " << (uint) registers.f
+        << " F: " << (uint) flags()
         << " H: " << (uint) registers.h
         << " L: " << (uint) registers.l << std::endl;
         std::cout
@@ -102,19 +454,733 @@ private:
         std::cout << "---------------------------------" << std::endl;
     }
 
+    // nothing can change before the next event, either halted or spinning in an idle loop:
+    // skip whole iterations up to it
+    void fast_forward(u64 to) {
+        if (to <= scheduler.now || enable_interrupts)
+            return;
+
+        u64 period = halted ? 4 : idle_period;
+        u64 cycles = (to - scheduler.now + period - 1) / period * period;
+        if (!halted)
+            cycles -= period; // stop short, the last round is run for real
+
+        scheduler.now += cycles;
+        skipped += cycles;
+#if GBEMUZ_PROFILE
+        profile.idle(cycles);
+#endif
+    }
+
+    size_t interrupt(u8 pending) {
+        u8 bit = pending & -pending;
+        mmu.acknowledge_interrupt(bit);
+        interrupt_enabled = false;
+        push(registers.pc);
+        registers.pc = 0x40 + 8 * __builtin_ctz(bit);
+#if GBEMUZ_PROFILE
+        profile.interrupt(registers.pc, 20);
+#endif
+        return 20;
+    }
+
     size_t exec() {
         u8 op = read_u8();
 //        print_debug(op);
 
-        if (op == 0xcb)
-            exec_prefixed(read_u8());
+        return (this->*regular_handler(op))();
+    }
+
+#if GBEMUZ_THREADED
+    // the interpreter without going back to step() after every instruction. each opcode has its own
+    // copy of the dispatch, so its jump gets predicted from what tends to follow that opcode. stops at
+    // limit, at an event scheduled sooner by what ran (a read of ly bringing the ppu back to per line
+    // events), and wherever step() has work to do: after halt and ei, and on an interrupt it would take
+    bool run_threaded(u64 limit) {
+        if (halted || enable_interrupts || (interrupt_enabled && mmu.pending_interrupts()) || scheduler.now >= limit)
+            return false;
+
+#define GBEMUZ_ROW(X, h) X(h, 0) X(h, 1) X(h, 2) X(h, 3) X(h, 4) X(h, 5) X(h, 6) X(h, 7) \
+    X(h, 8) X(h, 9) X(h, a) X(h, b) X(h, c) X(h, d) X(h, e) X(h, f)
+#define GBEMUZ_OPCODES(X) GBEMUZ_ROW(X, 0x0) GBEMUZ_ROW(X, 0x1) GBEMUZ_ROW(X, 0x2) GBEMUZ_ROW(X, 0x3) \
+    GBEMUZ_ROW(X, 0x4) GBEMUZ_ROW(X, 0x5) GBEMUZ_ROW(X, 0x6) GBEMUZ_ROW(X, 0x7) GBEMUZ_ROW(X, 0x8) \
+    GBEMUZ_ROW(X, 0x9) GBEMUZ_ROW(X, 0xa) GBEMUZ_ROW(X, 0xb) GBEMUZ_ROW(X, 0xc) GBEMUZ_ROW(X, 0xd) \
+    GBEMUZ_ROW(X, 0xe) GBEMUZ_ROW(X, 0xf)
+#define GBEMUZ_LABEL(h, l) &&op_##h##l,
+#define GBEMUZ_DISPATCH() \
+    if (scheduler.now >= limit || scheduler.now >= scheduler.deadline() \
+        || (interrupt_enabled && mmu.pending_interrupts())) \
+        return true; \
+    goto *labels[read_u8()];
+#define GBEMUZ_HANDLER(h, l) \
+    op_##h##l: \
+    scheduler.now += regular<h##l>(); \
+    if (h##l == 0x76 || h##l == 0xfb) \
+        return true; \
+    GBEMUZ_DISPATCH()
+
+        static const void* const labels[256] = {GBEMUZ_OPCODES(GBEMUZ_LABEL)};
+        goto *labels[read_u8()];
+        GBEMUZ_OPCODES(GBEMUZ_HANDLER)
+
+#undef GBEMUZ_HANDLER
+#undef GBEMUZ_DISPATCH
+#undef GBEMUZ_LABEL
+#undef GBEMUZ_OPCODES
+#undef GBEMUZ_ROW
+    }
+#endif
+
+    size_t exec_block() {
+        u16 pc = registers.pc;
+        const Block& block = find_block(pc);
+        if (block.code.empty()) // starts on an instruction running into the next page
+            return exec();
+        return looped(block, pc, run_block(block, pc));
+    }
+
+    size_t looped(const Block& block, u16 pc, size_t cycles) {
+        if (block.idle && registers.pc == pc)
+            idle_period = cycles;
+        return cycles;
+    }
+
+    Block& find_block(u16 pc) {
+        Block& block = blocks[(mmu.bank(pc) << 16) | pc];
+
+        if (block.code.empty() || block.version != mmu.page_version(pc))
+            decode_block(block, pc);
+
+        return block;
+    }
+
+    size_t run_block(const Block& block, u16 pc) {
+        size_t total = 0;
+        const Decoded* end = block.code.data() + block.code.size();
+        for (const Decoded* d = block.code.data(); d < end;) {
+            if (fusion && d->fusion != Fusion::None) {
+                total += run_fused(block, pc, d, total);
+                d += span(d->fusion);
+            } else {
+                registers.pc += d->opcode_length;
+                prefetched = d->operands;
+                total += (this->*d->handler)();
+                d++;
+            }
+
+            if (block.version != mmu.page_version(pc)) // wrote into its own code
+                break;
+        }
+        prefetched = nullptr;
+
+        return total;
+    }
+
+    static constexpr size_t span(Fusion f) { return f == Fusion::Countdown ? 2 : f == Fusion::CopyInc ? 4 : 3; }
+
+    // the parts are the same handlers, called straight from here and without the checks run_block
+    // makes in between. elapsed is what the block took before d
+    size_t run_fused(const Block& block, u16 pc, const Decoded* d, size_t elapsed) {
+        fused[static_cast<size_t>(d->fusion)]++;
+
+        switch (d->fusion) {
+            case Fusion::Copy:
+            case Fusion::CopyInc: {
+                size_t cycles = part<0x2a>(d[0]) + part<0x12>(d[1]);
+                if (block.version != mmu.page_version(pc)) // the rest is left to the block decoded next
+                    return cycles;
+                if (d->fusion == Fusion::CopyInc)
+                    cycles += part<0x13>(d[2]);
+                return cycles + part<0x0b>(d[span(d->fusion) - 1]);
+            }
+            case Fusion::Poll:
+                return part<0xf0>(d[0]) + part<0xfe>(d[1]) + part<0x20>(d[2]);
+            default:
+                switch (d->opcode) {
+                    case 0x05: return countdown<0x05>(d, elapsed);
+                    case 0x0d: return countdown<0x0d>(d, elapsed);
+                    case 0x15: return countdown<0x15>(d, elapsed);
+                    case 0x1d: return countdown<0x1d>(d, elapsed);
+                    case 0x25: return countdown<0x25>(d, elapsed);
+                    case 0x2d: return countdown<0x2d>(d, elapsed);
+                    default: return countdown<0x3d>(d, elapsed);
+                }
+        }
+    }
+
+    template<u8 op>
+    size_t part(const Decoded& d) {
+        registers.pc++;
+        prefetched = d.operands;
+        return regular<op>();
+    }
+
+    // run() would come back to the same two instructions after each time around, unless the clock
+    // got to limit or an interrupt is due, and neither of them can change that
+    template<u8 op>
+    size_t countdown(const Decoded* d, size_t elapsed) {
+        u16 start = registers.pc;
+        bool stays = !enable_interrupts && !(interrupt_enabled && mmu.pending_interrupts());
+        size_t total = 0;
+
+        for (;;) {
+            total += part<op>(d[0]) + part<0x20>(d[1]);
+            if (!stays || registers.pc != start || scheduler.now + elapsed + total >= limit)
+                return total;
+            fused[static_cast<size_t>(Fusion::Countdown)]++;
+        }
+    }
+
+    void decode_block(Block& block, u16 pc) {
+        u16 start = pc;
+        block.code.clear();
+        block.version = mmu.page_version(pc);
+        block.hits = 0;
+        block.native = nullptr;
+
+        u16 page = pc >> 8;
+        while (true) {
+            u8 op = mmu.read(pc);
+            bool prefixed = op == 0xcb;
+            u8 length = instruction_length(op);
+            if (((pc + length - 1) >> 8) != page) // next one is decoded as its own block, or run by exec()
+                break;
+
+            Decoded d{};
+            d.opcode = prefixed ? mmu.read(pc + 1) : op;
+            d.opcode_length = prefixed ? 2 : 1;
+            d.handler = prefixed ? prefixed_handler(d.opcode) : regular_handler(op);
+            for (u8 i = d.opcode_length; i < length; i++)
+                d.operands[i - d.opcode_length] = mmu.read(pc + i);
+            block.code.push_back(d);
+
+            pc += length;
+            if (ends_block(op) || (pc >> 8) != page)
+                break;
+        }
+
+        block.idle = idle_loop(block.code, start, pc);
+        if constexpr (fusion)
+            fuse(block.code);
+    }
+
+    // marks where a sequence run_fused knows starts, none of them overlap
+    static void fuse(std::vector<Decoded>& code) {
+        auto is = [&](size_t i, u8 op) {
+            return i < code.size() && code[i].opcode_length == 1 && code[i].opcode == op;
+        };
+
+        for (size_t i = 0; i < code.size(); i++) {
+            u8 op = code[i].opcode;
+            if (is(i, 0x2a) && is(i + 1, 0x12) && is(i + 2, 0x0b))
+                code[i].fusion = Fusion::Copy;
+            else if (is(i, 0x2a) && is(i + 1, 0x12) && is(i + 2, 0x13) && is(i + 3, 0x0b))
+                code[i].fusion = Fusion::CopyInc;
+            else if (is(i, 0xf0) && is(i + 1, 0xfe) && is(i + 2, 0x20))
+                code[i].fusion = Fusion::Poll;
+            else if (is(i, op) && (op & 0xc7) == 0x05 && op != 0x35 && is(i + 1, 0x20))
+                code[i].fusion = Fusion::Countdown;
+            else
+                continue;
+            i += span(code[i].fusion) - 1;
+        }
+    }
+
+    // a read, a test that overwrites the flags it branches on and a jump back: looping once
+    // means looping until whatever was read changes, and only an event changes it. div and
+    // tima are left out, they tick without one
+    static bool idle_loop(const std::vector<Decoded>& code, u16 start, u16 end) {
+        if (code.size() != 3)
+            return false;
+
+        const Decoded& read = code[0];
+        const Decoded& test = code[1];
+        const Decoded& jump = code[2];
+
+        u16 address;
+        if (read.opcode_length == 1 && read.opcode == 0xf0)
+            address = 0xff00 + read.operands[0];
+        else if (read.opcode_length == 1 && read.opcode == 0xfa)
+            address = read.operands[0] | (read.operands[1] << 8);
         else
-            exec_regular(op);
+            return false;
+        if (address == 0xff04 || address == 0xff05)
+            return false;
+
+        bool tests_a = test.opcode_length == 2
+            ? (test.opcode & 0xc7) == 0x47 // bit b, a
+            : test.opcode == 0xfe || test.opcode == 0xe6 || test.opcode == 0xa7 || test.opcode == 0xb7;
+        if (!tests_a || jump.opcode_length != 1)
+            return false;
+
+        switch (jump.opcode) {
+            case 0x20: case 0x28: case 0x30: case 0x38:
+                return static_cast<u16>(end + static_cast<s8>(jump.operands[0])) == start;
+            case 0xc2: case 0xca: case 0xd2: case 0xda:
+                return (jump.operands[0] | (jump.operands[1] << 8)) == start;
+            default:
+                return false;
+        }
+    }
+
+#if GBEMUZ_JIT
+    static constexpr u32 jit_threshold = 32;
+
+    size_t exec_jit() {
+        u16 pc = registers.pc;
+        Block& block = find_block(pc);
+        if (block.code.empty())
+            return exec();
+
+        if (block.native) { // translated code works on f directly
+            materialize_flags();
+            return looped(block, pc, block.native(this, &registers, lahf_flags().data()));
+        }
+
+        if (++block.hits == jit_threshold)
+            compile_block(block, pc);
+
+        return looped(block, pc, run_block(block, pc));
+    }
+
+    // lahf leaves SF ZF 0 AF 0 PF 1 CF in ah, this maps it onto Z H C
+    static const std::array<u8, 256>& lahf_flags() {
+        static constexpr auto table = [] {
+            std::array<u8, 256> t{};
+            for (int i = 0; i < 256; i++)
+                t[i] = (i & 0x40 ? 0x80 : 0) | (i & 0x10 ? 0x20 : 0) | (i & 0x01 ? 0x10 : 0);
+            return t;
+        }();
+        return table;
+    }
+
+    // runs one decoded instruction for translated code, non zero means the block went stale
+    static u32 jit_fallback(CPU* cpu, const Decoded* d, u32 pc, u32 version) {
+        jit_fallback_last(cpu, d, pc, version);
+        return cpu->mmu.page_version(pc) != version;
+    }
+
+    // same for the instruction ending a block, returns its cycles since a branch may be taken
+    static u32 jit_fallback_last(CPU* cpu, const Decoded* d, u32 pc, u32) {
+        cpu->registers.pc = pc + d->opcode_length;
+        cpu->prefetched = d->operands;
+        u32 cycles = (cpu->*d->handler)();
+        cpu->prefetched = nullptr;
+        cpu->materialize_flags();
+        return cycles;
+    }
+
+    static u8 reg_offset(u8 r) {
+        switch (r) {
+            case 0: return offsetof(Registers, b);
+            case 1: return offsetof(Registers, c);
+            case 2: return offsetof(Registers, d);
+            case 3: return offsetof(Registers, e);
+            case 4: return offsetof(Registers, h);
+            case 5: return offsetof(Registers, l);
+            default: return offsetof(Registers, a);
+        }
+    }
+
+    static u8 rp_offset(u8 p) {
+        switch (p) {
+            case 0: return offsetof(Registers, bc);
+            case 1: return offsetof(Registers, de);
+            case 2: return offsetof(Registers, hl);
+            default: return offsetof(Registers, sp);
+        }
+    }
+
+    // only rom is translated, ram code may be rewritten at any time. blocks talking to io stay
+    // in the interpreter too, as do blocks with too little to translate
+    bool worth_compiling(const Block& block, u16 pc) const {
+        if (pc >= 0x8000)
+            return false;
 
-        return cycles(op);
+        size_t translatable = 0;
+        for (const Decoded& d : block.code) {
+            u8 op = d.opcode_length == 2 ? 0xcb : d.opcode;
+            if (op == 0xe0 || op == 0xf0 || op == 0xe2 || op == 0xf2)
+                return false;
+            translatable += compiles(d);
+        }
+        return translatable * 2 >= block.code.size();
     }
 
-    void exec_regular(u8 op) {
+    static bool compiles(const Decoded& d) {
+        if (d.opcode_length == 2)
+            return (d.opcode & 7) != 6;
+
+        u8 op = d.opcode;
+        switch (op) {
+            case 0x00: case 0x07: case 0x0f: case 0x17: case 0x1f: case 0x2f: case 0x37: case 0x3f:
+            case 0x01: case 0x11: case 0x21: case 0x31: case 0x03: case 0x13: case 0x23: case 0x33:
+            case 0x0b: case 0x1b: case 0x2b: case 0x3b:
+                return true;
+            case 0x04: case 0x05: case 0x06: case 0x0c: case 0x0d: case 0x0e: case 0x14: case 0x15:
+            case 0x16: case 0x1c: case 0x1d: case 0x1e: case 0x24: case 0x25: case 0x26: case 0x2c:
+            case 0x2d: case 0x2e: case 0x3c: case 0x3d: case 0x3e:
+                return true;
+            case 0x40 ... 0x7f:
+                return op != 0x76 && (op & 7) != 6 && ((op >> 3) & 7) != 6;
+            case 0x80 ... 0xbf:
+                return (op & 7) != 6;
+            case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void compile_block(Block& block, u16 pc) {
+        if (!worth_compiling(block, pc))
+            return;
+
+        const u8 F = offsetof(Registers, f), A = offsetof(Registers, a), PC = offsetof(Registers, pc);
+        using E = X64Emitter;
+        E e;
+        e.prologue();
+
+        u32 total = 0;
+        bool pc_stale = false;
+        for (const Decoded& d : block.code) {
+            if (!compiles(d) && &d == &block.code.back()) {
+                e.call(reinterpret_cast<const void*>(&CPU::jit_fallback_last), &d, pc, block.version);
+                e.epilogue_add(total);
+                pc_stale = false;
+                break;
+            }
+
+            total += d.opcode_length == 2 ? prefixed_cycles[d.opcode] : regular_cycles[d.opcode];
+
+            if (!compiles(d)) {
+                e.call(reinterpret_cast<const void*>(&CPU::jit_fallback), &d, pc, block.version);
+                e.exit_if_eax(total);
+                pc = static_cast<u16>(pc + instruction_length(d.opcode_length == 2 ? 0xcb : d.opcode));
+                pc_stale = false;
+                continue;
+            }
+
+            if (d.opcode_length == 2) {
+                compile_rot_bit(e, d.opcode >> 3, reg_offset(d.opcode & 7), true);
+                pc += 2;
+                pc_stale = true;
+                continue;
+            }
+
+            u8 op = d.opcode;
+            u8 x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+            switch (op) {
+                case 0x00: break;
+                case 0x07: case 0x0f: case 0x17: case 0x1f:
+                    compile_rot_bit(e, y, A, false);
+                    break;
+                case 0x2f: // cpl
+                    e.load(E::al, A);
+                    e.not_r8(E::al);
+                    e.store(A, E::al);
+                    e.or_mem_imm8(F, 0x60);
+                    break;
+                case 0x37: // scf
+                    e.and_mem_imm8(F, 0x80);
+                    e.or_mem_imm8(F, 0x10);
+                    break;
+                case 0x3f: // ccf
+                    e.load(E::al, F);
+                    e.and_imm8(E::al, 0x90);
+                    e.xor_imm8(E::al, 0x10);
+                    e.store(F, E::al);
+                    break;
+                case 0x01: case 0x11: case 0x21: case 0x31:
+                    e.store_imm16(rp_offset(y >> 1), d.operands[0] | (d.operands[1] << 8));
+                    break;
+                case 0x03: case 0x13: case 0x23: case 0x33:
+                    e.inc_mem16(rp_offset(y >> 1));
+                    break;
+                case 0x0b: case 0x1b: case 0x2b: case 0x3b:
+                    e.dec_mem16(rp_offset(y >> 1));
+                    break;
+                default:
+                    if (x == 0 && z == 6) { // ld r, n
+                        e.store_imm8(reg_offset(y), d.operands[0]);
+                    } else if (x == 0) { // inc r / dec r
+                        e.load(E::al, reg_offset(y));
+                        if (z == 4)
+                            e.inc_r8(E::al);
+                        else
+                            e.dec_r8(E::al);
+                        e.lahf_flags();
+                        e.and_imm8(E::dl, 0xa0);
+                        if (z == 5)
+                            e.or_imm8(E::dl, 0x40);
+                        e.load(E::cl, F);
+                        e.and_imm8(E::cl, 0x10);
+                        e.or_r8(E::dl, E::cl);
+                        e.store(F, E::dl);
+                        e.store(reg_offset(y), E::al);
+                    } else if (x == 1) { // ld r1, r2
+                        e.load(E::al, reg_offset(z));
+                        e.store(reg_offset(y), E::al);
+                    } else { // alu a, r / alu a, n
+                        e.load(E::al, A);
+                        if (x == 3)
+                            e.mov_imm8(E::cl, d.operands[0]);
+                        else
+                            e.load(E::cl, reg_offset(z));
+                        compile_alu(e, y);
+                    }
+            }
+            pc += instruction_length(op);
+            pc_stale = true;
+        }
+
+        if (pc_stale) {
+            e.store_imm16(PC, pc);
+            e.epilogue(total);
+        }
+
+        void* native = arena.place(e.code);
+        if (!native) { // full, start over
+            arena.reset();
+            for (auto& [key, b] : blocks)
+                b.native = nullptr;
+            native = arena.place(e.code);
+        }
+        if (!arena.usable()) // no executable memory to be had, the block cache does it all from now on
+            mode = Mode::BlockCache;
+        block.native = reinterpret_cast<Native>(native);
+    }
+
+    // al = a, cl = operand, for add adc sub sbc and xor or cp
+    void compile_alu(X64Emitter& e, u8 y) {
+        using E = X64Emitter;
+        const u8 F = offsetof(Registers, f), A = offsetof(Registers, a);
+        static constexpr u8 opcodes[] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+
+        if (y == 1 || y == 3) { // carry in, shr leaves bit 4 in CF
+            e.load(E::dl, F);
+            e.shift(5, E::dl, 5);
+        }
+        e.alu_al_cl(opcodes[y]);
+
+        if (y >= 4 && y <= 6) {
+            e.setz(E::dl);
+            e.shift(4, E::dl, 7);
+            if (y == 4)
+                e.or_imm8(E::dl, 0x20);
+        } else {
+            e.lahf_flags();
+            if (y >= 2)
+                e.or_imm8(E::dl, 0x40);
+        }
+        e.store(F, E::dl);
+
+        if (y != 7)
+            e.store(A, E::al);
+    }
+
+    // rot<op, r> for op < 8, bit/res/set above. prefixed false is rlca and friends, which clear Z
+    void compile_rot_bit(X64Emitter& e, u8 op, u8 r, bool prefixed) {
+        using E = X64Emitter;
+        const u8 F = offsetof(Registers, f);
+
+        if (op >= 16) { // res / set
+            u8 mask = 1 << (op & 7);
+            if (op < 24)
+                e.and_mem_imm8(r, ~mask);
+            else
+                e.or_mem_imm8(r, mask);
+            return;
+        }
+
+        e.load(E::al, r);
+
+        if (op >= 8) { // bit
+            e.test_imm8(E::al, 1 << (op & 7));
+            e.setz(E::dl);
+            e.shift(4, E::dl, 7);
+            e.or_imm8(E::dl, 0x20);
+            e.load(E::cl, F);
+            e.and_imm8(E::cl, 0x10);
+            e.or_r8(E::dl, E::cl);
+            e.store(F, E::dl);
+            return;
+        }
+
+        if (op == 2 || op == 3) {
+            e.load(E::dl, F);
+            e.shift(5, E::dl, 5);
+        }
+
+        static constexpr u8 shifts[] = {0, 1, 2, 3, 4, 7, 0, 5}; // rlc rrc rl rr sla sra swap srl
+        if (op == 6) {
+            e.shift(0, E::al, 4);
+            e.mov_imm8(E::dl, 0);
+        } else {
+            e.shift1(shifts[op], E::al);
+            e.setc(E::dl);
+        }
+        e.shift(4, E::dl, 4);
+
+        if (prefixed) {
+            e.test_r8(E::al);
+            e.setz(E::cl);
+            e.shift(4, E::cl, 7);
+            e.or_r8(E::dl, E::cl);
+        }
+        e.store(F, E::dl);
+        e.store(r, E::al);
+    }
+#endif
+
+#if GBEMUZ_PROFILE
+    // every way of running an instruction comes through regular<op> or prefixed<op>, with pc just past
+    // the opcode
+    template<u8 op>
+    size_t regular() {
+        if constexpr (op == 0xcb) {
+            return run_regular<op>(); // counted as the prefixed one
+        } else {
+            u16 pc = registers.pc - 1;
+            u16 bank = mmu.bank(pc);
+            size_t cycles = run_regular<op>();
+            profile.instruction(op, false, pc, bank, cycles);
+
+            constexpr bool conditional = (op & 0xe7) == 0xc0 || (op & 0xe7) == 0xc4;
+            if (!conditional || cycles > regular_cycles[op]) {
+                if constexpr (op == 0xcd || (op & 0xe7) == 0xc4 || (op & 0xc7) == 0xc7)
+                    profile.call(registers.pc, mmu.bank(registers.pc));
+                else if constexpr (op == 0xc9 || op == 0xd9 || (op & 0xe7) == 0xc0)
+                    profile.ret();
+            }
+            return cycles;
+        }
+    }
+
+    template<u8 op>
+    size_t prefixed() {
+        u16 pc = registers.pc - 2;
+        u16 bank = mmu.bank(pc);
+        size_t cycles = run_prefixed<op>();
+        profile.instruction(op, true, pc, bank, cycles);
+        return cycles;
+    }
+#else
+    template<u8 op>
+    size_t regular() { return run_regular<op>(); }
+
+    template<u8 op>
+    size_t prefixed() { return run_prefixed<op>(); }
+#endif
+
+    // the 0x40 - 0xbf block and the whole cb page are regular grids, their handlers come straight
+    // from the opcode bits. the rest is spelled out in exec_regular
+    template<u8 op>
+    [[gnu::always_inline]] inline size_t run_regular() {
+        constexpr u8 y = (op >> 3) & 7, z = op & 7;
+
+        if constexpr (op == 0xcb)
+            return (this->*prefixed_handler(read_u8()))();
+        else if constexpr (op >= 0x40 && op < 0x80 && op != 0x76)
+            ld_r1_r2<y, z>();
+        else if constexpr (op >= 0x80 && op < 0xc0)
+            alu_a<y, z>();
+        else
+            return exec_regular(op);
+
+        return regular_cycles[op];
+    }
+
+    template<u8 op>
+    [[gnu::always_inline]] inline size_t run_prefixed() {
+        constexpr u8 x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+        if constexpr (x == 0)
+            rot<y, z>();
+        else if constexpr (x == 1)
+            bit<y, z>();
+        else if constexpr (x == 2)
+            res<y, z>();
+        else
+            set<y, z>();
+
+        return prefixed_cycles[op];
+    }
+
+    // add adc sub sbc and xor or cp, in opcode order
+    template<u8 y, u8 r>
+    void alu_a() {
+        if constexpr (y == 0)
+            add<r>();
+        else if constexpr (y == 1)
+            adc<r>();
+        else if constexpr (y == 2)
+            sub<r>();
+        else if constexpr (y == 3)
+            sbc<r>();
+        else if constexpr (y == 4)
+            and_<r>();
+        else if constexpr (y == 5)
+            xor_<r>();
+        else if constexpr (y == 6)
+            or_<r>();
+        else
+            cp<r>();
+    }
+
+    template<size_t... ops>
+    static constexpr std::array<Handler, 256> regular_handlers(std::index_sequence<ops...>) {
+        return {&CPU::regular<ops>...};
+    }
+
+    template<size_t... ops>
+    static constexpr std::array<Handler, 256> prefixed_handlers(std::index_sequence<ops...>) {
+        return {&CPU::prefixed<ops>...};
+    }
+
+    static Handler regular_handler(u8 op) {
+        static constexpr auto handlers = regular_handlers(std::make_index_sequence<256>{});
+        return handlers[op];
+    }
+
+    static Handler prefixed_handler(u8 op) {
+        static constexpr auto handlers = prefixed_handlers(std::make_index_sequence<256>{});
+        return handlers[op];
+    }
+
+    static constexpr u8 instruction_length(u8 op) {
+        switch (op) {
+            case 0x01: case 0x08: case 0x11: case 0x21: case 0x31: case 0xc2: case 0xc3: case 0xc4:
+            case 0xca: case 0xcc: case 0xcd: case 0xd2: case 0xd4: case 0xda: case 0xdc: case 0xea:
+            case 0xfa:
+                return 3;
+            case 0x06: case 0x0e: case 0x10: case 0x16: case 0x18: case 0x1e: case 0x20: case 0x26:
+            case 0x28: case 0x2e: case 0x30: case 0x36: case 0x38: case 0x3e: case 0xc6: case 0xcb:
+            case 0xce: case 0xd6: case 0xde: case 0xe0: case 0xe6: case 0xe8: case 0xee: case 0xf0:
+            case 0xf6: case 0xf8: case 0xfe:
+                return 2;
+            default:
+                return 1;
+        }
+    }
+
+    // anything that jumps, stops or changes interrupt state, plus the unimplemented ones
+    static constexpr bool ends_block(u8 op) {
+        switch (op) {
+            case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: case 0x76:
+            case 0xc0: case 0xc2 ... 0xc4: case 0xc7 ... 0xca: case 0xcc: case 0xcd: case 0xcf:
+            case 0xd0: case 0xd2 ... 0xd4: case 0xd7 ... 0xdd: case 0xdf:
+            case 0xe3: case 0xe4: case 0xe7: case 0xe9: case 0xeb ... 0xed: case 0xef:
+            case 0xf3: case 0xf4: case 0xf7: case 0xfb ... 0xfd: case 0xff:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    [[gnu::always_inline]] inline size_t exec_regular(u8 op) {
+        size_t taken = 0;
+
         switch (op) {
             case 0x00: break;
             case 0x01: ld_rp_nn<0>(); break;
@@ -123,7 +1189,7 @@ private:
             case 0x04: inc_r<0>(); break;
             case 0x05: dec_r<0>(); break;
             case 0x06: ld_r_n<0>(); break;
-            case 0x07: rot<0, 7>(); set_flag(Flag::Zero, false); break;
+            case 0x07: rot<0, 7, FlagOp::RotA>(); break;
             case 0x08: ld_nn_sp(); break;
             case 0x09: add_hl_n<0>(); break;
             case 0x0a: ldid_nn_a<0>(); break;
@@ -131,7 +1197,7 @@ private:
             case 0x0c: inc_r<1>(); break;
             case 0x0d: dec_r<1>(); break;
             case 0x0e: ld_r_n<1>(); break;
-            case 0x0f: rot<1, 7>(); set_flag(Flag::Zero, false); break;
+            case 0x0f: rot<1, 7, FlagOp::RotA>(); break;
             case 0x10: stop(); break;
             case 0x11: ld_rp_nn<1>(); break;
             case 0x12: ldid_a_nn<1>(); break;
@@ -139,7 +1205,7 @@ private:
             case 0x14: inc_r<2>(); break;
             case 0x15: dec_r<2>(); break;
             case 0x16: ld_r_n<2>(); break;
-            case 0x17: rot<2, 7>(); set_flag(Flag::Zero, false); break;
+            case 0x17: rot<2, 7, FlagOp::RotA>(); break;
             case 0x18: jr_n(); break;
             case 0x19: add_hl_n<1>(); break;
             case 0x1a: ldid_nn_a<1>(); break;
@@ -147,8 +1213,8 @@ private:
             case 0x1c: inc_r<3>(); break;
             case 0x1d: dec_r<3>(); break;
             case 0x1e: ld_r_n<3>(); break;
-            case 0x1f: rot<3, 7>(); set_flag(Flag::Zero, false); break;
-            case 0x20: j_cc_n<0, true>(); break;
+            case 0x1f: rot<3, 7, FlagOp::RotA>(); break;
+            case 0x20: taken = j_cc_n<0, true>(); break;
             case 0x21: ld_rp_nn<2>(); break;
             case 0x22: ldid_a_nn<2>(); break;
             case 0x23: inc_rr<2>(); break;
@@ -156,7 +1222,7 @@ private:
             case 0x25: dec_r<4>(); break;
             case 0x26: ld_r_n<4>(); break;
             case 0x27: daa(); break;
-            case 0x28: j_cc_n<1, true>(); break;
+            case 0x28: taken = j_cc_n<1, true>(); break;
             case 0x29: add_hl_n<2>(); break;
             case 0x2a: ldid_nn_a<2>(); break;
             case 0x2b: dec_rr<2>(); break;
@@ -164,7 +1230,7 @@ private:
             case 0x2d: dec_r<5>(); break;
             case 0x2e: ld_r_n<5>(); break;
             case 0x2f: cpl(); break;
-            case 0x30: j_cc_n<2, true>(); break;
+            case 0x30: taken = j_cc_n<2, true>(); break;
             case 0x31: ld_rp_nn<3>(); break;
             case 0x32: ldid_a_nn<3>(); break;
             case 0x33: inc_rr<3>(); break;
@@ -172,7 +1238,7 @@ private:
             case 0x35: dec_r<6>(); break;
             case 0x36: ld_r_n<6>(); break;
             case 0x37: scf(); break;
-            case 0x38: j_cc_n<3, true>(); break;
+            case 0x38: taken = j_cc_n<3, true>(); break;
             case 0x39: add_hl_n<3>(); break;
             case 0x3a: ldid_nn_a<3>(); break;
             case 0x3b: dec_rr<3>(); break;
@@ -180,75 +1246,33 @@ private:
             case 0x3d: dec_r<7>(); break;
             case 0x3e: ld_r_n<7>(); break;
             case 0x3f: ccf(); break;
-            case 0x40: ld_r1_r2<0, 0>(); break; case 0x41: ld_r1_r2<0, 1>(); break; case 0x42: ld_r1_r2<0, 2>(); break;
-            case 0x43: ld_r1_r2<0, 3>(); break; case 0x44: ld_r1_r2<0, 4>(); break; case 0x45: ld_r1_r2<0, 5>(); break;
-            case 0x46: ld_r1_r2<0, 6>(); break; case 0x47: ld_r1_r2<0, 7>(); break; case 0x48: ld_r1_r2<1, 0>(); break;
-            case 0x49: ld_r1_r2<1, 1>(); break; case 0x4a: ld_r1_r2<1, 2>(); break; case 0x4b: ld_r1_r2<1, 3>(); break;
-            case 0x4c: ld_r1_r2<1, 4>(); break; case 0x4d: ld_r1_r2<1, 5>(); break; case 0x4e: ld_r1_r2<1, 6>(); break;
-            case 0x4f: ld_r1_r2<1, 7>(); break; case 0x50: ld_r1_r2<2, 0>(); break; case 0x51: ld_r1_r2<2, 1>(); break;
-            case 0x52: ld_r1_r2<2, 2>(); break; case 0x53: ld_r1_r2<2, 3>(); break; case 0x54: ld_r1_r2<2, 4>(); break;
-            case 0x55: ld_r1_r2<2, 5>(); break; case 0x56: ld_r1_r2<2, 6>(); break; case 0x57: ld_r1_r2<2, 7>(); break;
-            case 0x58: ld_r1_r2<3, 0>(); break; case 0x59: ld_r1_r2<3, 1>(); break; case 0x5a: ld_r1_r2<3, 2>(); break;
-            case 0x5b: ld_r1_r2<3, 3>(); break; case 0x5c: ld_r1_r2<3, 4>(); break; case 0x5d: ld_r1_r2<3, 5>(); break;
-            case 0x5e: ld_r1_r2<3, 6>(); break; case 0x5f: ld_r1_r2<3, 7>(); break; case 0x60: ld_r1_r2<4, 0>(); break;
-            case 0x61: ld_r1_r2<4, 1>(); break; case 0x62: ld_r1_r2<4, 2>(); break; case 0x63: ld_r1_r2<4, 3>(); break;
-            case 0x64: ld_r1_r2<4, 4>(); break; case 0x65: ld_r1_r2<4, 5>(); break; case 0x66: ld_r1_r2<4, 6>(); break;
-            case 0x67: ld_r1_r2<4, 7>(); break; case 0x68: ld_r1_r2<5, 0>(); break; case 0x69: ld_r1_r2<5, 1>(); break;
-            case 0x6a: ld_r1_r2<5, 2>(); break; case 0x6b: ld_r1_r2<5, 3>(); break; case 0x6c: ld_r1_r2<5, 4>(); break;
-            case 0x6d: ld_r1_r2<5, 5>(); break; case 0x6e: ld_r1_r2<5, 6>(); break; case 0x6f: ld_r1_r2<5, 7>(); break;
-            case 0x70: ld_r1_r2<6, 0>(); break; case 0x71: ld_r1_r2<6, 1>(); break; case 0x72: ld_r1_r2<6, 2>(); break;
-            case 0x73: ld_r1_r2<6, 3>(); break; case 0x74: ld_r1_r2<6, 4>(); break; case 0x75: ld_r1_r2<6, 5>(); break;
-            case 0x76: ld_r1_r2<6, 6>(); break; case 0x77: ld_r1_r2<6, 7>(); break; case 0x78: ld_r1_r2<7, 0>(); break;
-            case 0x79: ld_r1_r2<7, 1>(); break; case 0x7a: ld_r1_r2<7, 2>(); break; case 0x7b: ld_r1_r2<7, 3>(); break;
-            case 0x7c: ld_r1_r2<7, 4>(); break; case 0x7d: ld_r1_r2<7, 5>(); break; case 0x7e: ld_r1_r2<7, 6>(); break;
-            case 0x7f: ld_r1_r2<7, 7>(); break;
-            case 0x80: add<0>(); break; case 0x81: add<1>(); break; case 0x82: add<2>(); break;
-            case 0x83: add<3>(); break; case 0x84: add<4>(); break; case 0x85: add<5>(); break;
-            case 0x86: add<6>(); break; case 0x87: add<7>(); break; case 0x88: adc<0>(); break;
-            case 0x89: adc<1>(); break; case 0x8a: adc<2>(); break; case 0x8b: adc<3>(); break;
-            case 0x8c: adc<4>(); break; case 0x8d: adc<5>(); break; case 0x8e: adc<6>(); break;
-            case 0x8f: adc<7>(); break; case 0x90: sub<0>(); break; case 0x91: sub<1>(); break;
-            case 0x92: sub<2>(); break; case 0x93: sub<3>(); break; case 0x94: sub<4>(); break;
-            case 0x95: sub<5>(); break; case 0x96: sub<6>(); break; case 0x97: sub<7>(); break;
-            case 0x98: sbc<0>(); break; case 0x99: sbc<1>(); break; case 0x9a: sbc<2>(); break;
-            case 0x9b: sbc<3>(); break; case 0x9c: sbc<4>(); break; case 0x9d: sbc<5>(); break;
-            case 0x9e: sbc<6>(); break; case 0x9f: sbc<7>(); break; case 0xa0: and_<0>(); break;
-            case 0xa1: and_<1>(); break; case 0xa2: and_<2>(); break; case 0xa3: and_<3>(); break;
-            case 0xa4: and_<4>(); break; case 0xa5: and_<5>(); break; case 0xa6: and_<6>(); break;
-            case 0xa7: and_<7>(); break; case 0xa8: xor_<0>(); break; case 0xa9: xor_<1>(); break;
-            case 0xaa: xor_<2>(); break; case 0xab: xor_<3>(); break; case 0xac: xor_<4>(); break;
-            case 0xad: xor_<5>(); break; case 0xae: xor_<6>(); break; case 0xaf: xor_<7>(); break;
-            case 0xb0: or_<0>(); break; case 0xb1: or_<1>(); break; case 0xb2: or_<2>(); break;
-            case 0xb3: or_<3>(); break; case 0xb4: or_<4>(); break; case 0xb5: or_<5>(); break;
-            case 0xb6: or_<6>(); break; case 0xb7: or_<7>(); break; case 0xb8: cp<0>(); break;
-            case 0xb9: cp<1>(); break; case 0xba: cp<2>(); break; case 0xbb: cp<3>(); break;
-            case 0xbc: cp<4>(); break; case 0xbd: cp<5>(); break; case 0xbe: cp<6>(); break; case 0xbf: cp<7>(); break;
-            case 0xc0: ret_cc<0>(); break;
+            case 0x76: halt(); break;
+            case 0xc0: taken = ret_cc<0>(); break;
             case 0xc1: pop_nn<0>(); break;
-            case 0xc2: j_cc_n<0>(); break;
+            case 0xc2: taken = j_cc_n<0>(); break;
             case 0xc3: jp_nn(); break;
-            case 0xc4: call_cc_nn<0>(); break;
+            case 0xc4: taken = call_cc_nn<0>(); break;
             case 0xc5: push_nn<0>(); break;
             case 0xc6: add<8>(); break;
             case 0xc7: rst<0>(); break;
-            case 0xc8: ret_cc<1>(); break;
+            case 0xc8: taken = ret_cc<1>(); break;
             case 0xc9: ret(); break;
-            case 0xca: j_cc_n<1>(); break;
-            case 0xcc: call_cc_nn<1>(); break;
+            case 0xca: taken = j_cc_n<1>(); break;
+            case 0xcc: taken = call_cc_nn<1>(); break;
             case 0xcd: call_nn(); break;
             case 0xce: adc<8>(); break;
             case 0xcf: rst<1>(); break;
-            case 0xd0: ret_cc<2>(); break;
+            case 0xd0: taken = ret_cc<2>(); break;
             case 0xd1: pop_nn<1>(); break;
-            case 0xd2: j_cc_n<2>(); break;
-            case 0xd4: call_cc_nn<2>(); break;
+            case 0xd2: taken = j_cc_n<2>(); break;
+            case 0xd4: taken = call_cc_nn<2>(); break;
             case 0xd5: push_nn<1>(); break;
             case 0xd6: sub<8>(); break;
             case 0xd7: rst<2>(); break;
-            case 0xd8: ret_cc<3>(); break;
+            case 0xd8: taken = ret_cc<3>(); break;
             case 0xd9: reti(); break;
-            case 0xda: j_cc_n<3>(); break;
-            case 0xdc: call_cc_nn<3>(); break;
+            case 0xda: taken = j_cc_n<3>(); break;
+            case 0xdc: taken = call_cc_nn<3>(); break;
             case 0xde: sbc<8>(); break;
             case 0xdf: rst<3>(); break;
             case 0xe2: ld_c_a(); break;
@@ -278,101 +1302,8 @@ private:
             default:
                 std::cout << "unimplemented " << op;
         }
-    }
 
-    void exec_prefixed(u8 op) {
-        switch (op) {
-            case 0x00: rot<0, 0>() ;break; case 0x01: rot<0, 1>() ;break; case 0x02: rot<0, 2>() ;break;
-            case 0x03: rot<0, 3>() ;break; case 0x04: rot<0, 4>() ;break; case 0x05: rot<0, 5>() ;break;
-            case 0x06: rot<0, 6>() ;break; case 0x07: rot<0, 7>() ;break; case 0x08: rot<1, 0>() ;break;
-            case 0x09: rot<1, 1>() ;break; case 0x0a: rot<1, 2>() ;break; case 0x0b: rot<1, 3>() ;break;
-            case 0x0c: rot<1, 4>() ;break; case 0x0d: rot<1, 5>() ;break; case 0x0e: rot<1, 6>() ;break;
-            case 0x0f: rot<1, 7>() ;break; case 0x10: rot<2, 0>() ;break; case 0x11: rot<2, 1>() ;break;
-            case 0x12: rot<2, 2>() ;break; case 0x13: rot<2, 3>() ;break; case 0x14: rot<2, 4>() ;break;
-            case 0x15: rot<2, 5>() ;break; case 0x16: rot<2, 6>() ;break; case 0x17: rot<2, 7>() ;break;
-            case 0x18: rot<3, 0>() ;break; case 0x19: rot<3, 1>() ;break; case 0x1a: rot<3, 2>() ;break;
-            case 0x1b: rot<3, 3>() ;break; case 0x1c: rot<3, 4>() ;break; case 0x1d: rot<3, 5>() ;break;
-            case 0x1e: rot<3, 6>() ;break; case 0x1f: rot<3, 7>() ;break; case 0x20: rot<4, 0>() ;break;
-            case 0x21: rot<4, 1>() ;break; case 0x22: rot<4, 2>() ;break; case 0x23: rot<4, 3>() ;break;
-            case 0x24: rot<4, 4>() ;break; case 0x25: rot<4, 5>() ;break; case 0x26: rot<4, 6>() ;break;
-            case 0x27: rot<4, 7>() ;break; case 0x28: rot<5, 0>() ;break; case 0x29: rot<5, 1>() ;break;
-            case 0x2a: rot<5, 2>() ;break; case 0x2b: rot<5, 3>() ;break; case 0x2c: rot<5, 4>() ;break;
-            case 0x2d: rot<5, 5>() ;break; case 0x2e: rot<5, 6>() ;break; case 0x2f: rot<5, 7>() ;break;
-            case 0x30: rot<6, 0>() ;break; case 0x31: rot<6, 1>() ;break; case 0x32: rot<6, 2>() ;break;
-            case 0x33: rot<6, 3>() ;break; case 0x34: rot<6, 4>() ;break; case 0x35: rot<6, 5>() ;break;
-            case 0x36: rot<6, 6>() ;break; case 0x37: rot<6, 7>() ;break; case 0x38: rot<7, 0>() ;break;
-            case 0x39: rot<7, 1>() ;break; case 0x3a: rot<7, 2>() ;break; case 0x3b: rot<7, 3>() ;break;
-            case 0x3c: rot<7, 4>() ;break; case 0x3d: rot<7, 5>() ;break; case 0x3e: rot<7, 6>() ;break;
-            case 0x3f: rot<7, 7>() ;break;
-            case 0x40: bit<0, 0>() ;break; case 0x41: bit<0, 1>() ;break; case 0x42: bit<0, 2>() ;break;
-            case 0x43: bit<0, 3>() ;break; case 0x44: bit<0, 4>() ;break; case 0x45: bit<0, 5>() ;break;
-            case 0x46: bit<0, 6>() ;break; case 0x47: bit<0, 7>() ;break; case 0x48: bit<1, 0>() ;break;
-            case 0x49: bit<1, 1>() ;break; case 0x4a: bit<1, 2>() ;break; case 0x4b: bit<1, 3>() ;break;
-            case 0x4c: bit<1, 4>() ;break; case 0x4d: bit<1, 5>() ;break; case 0x4e: bit<1, 6>() ;break;
-            case 0x4f: bit<1, 7>() ;break; case 0x50: bit<2, 0>() ;break; case 0x51: bit<2, 1>() ;break;
-            case 0x52: bit<2, 2>() ;break; case 0x53: bit<2, 3>() ;break; case 0x54: bit<2, 4>() ;break;
-            case 0x55: bit<2, 5>() ;break; case 0x56: bit<2, 6>() ;break; case 0x57: bit<2, 7>() ;break;
-            case 0x58: bit<3, 0>() ;break; case 0x59: bit<3, 1>() ;break; case 0x5a: bit<3, 2>() ;break;
-            case 0x5b: bit<3, 3>() ;break; case 0x5c: bit<3, 4>() ;break; case 0x5d: bit<3, 5>() ;break;
-            case 0x5e: bit<3, 6>() ;break; case 0x5f: bit<3, 7>() ;break; case 0x60: bit<4, 0>() ;break;
-            case 0x61: bit<4, 1>() ;break; case 0x62: bit<4, 2>() ;break; case 0x63: bit<4, 3>() ;break;
-            case 0x64: bit<4, 4>() ;break; case 0x65: bit<4, 5>() ;break; case 0x66: bit<4, 6>() ;break;
-            case 0x67: bit<4, 7>() ;break; case 0x68: bit<5, 0>() ;break; case 0x69: bit<5, 1>() ;break;
-            case 0x6a: bit<5, 2>() ;break; case 0x6b: bit<5, 3>() ;break; case 0x6c: bit<5, 4>() ;break;
-            case 0x6d: bit<5, 5>() ;break; case 0x6e: bit<5, 6>() ;break; case 0x6f: bit<5, 7>() ;break;
-            case 0x70: bit<6, 0>() ;break; case 0x71: bit<6, 1>() ;break; case 0x72: bit<6, 2>() ;break;
-            case 0x73: bit<6, 3>() ;break; case 0x74: bit<6, 4>() ;break; case 0x75: bit<6, 5>() ;break;
-            case 0x76: bit<6, 6>() ;break; case 0x77: bit<6, 7>() ;break; case 0x78: bit<7, 0>() ;break;
-            case 0x79: bit<7, 1>() ;break; case 0x7a: bit<7, 2>() ;break; case 0x7b: bit<7, 3>() ;break;
-            case 0x7c: bit<7, 4>() ;break; case 0x7d: bit<7, 5>() ;break; case 0x7e: bit<7, 6>() ;break;
-            case 0x7f: bit<7, 7>() ;break;
-            case 0x80: res<0, 0>() ;break; case 0x81: res<0, 1>() ;break; case 0x82: res<0, 2>() ;break;
-            case 0x83: res<0, 3>() ;break; case 0x84: res<0, 4>() ;break; case 0x85: res<0, 5>() ;break;
-            case 0x86: res<0, 6>() ;break; case 0x87: res<0, 7>() ;break; case 0x88: res<1, 0>() ;break;
-            case 0x89: res<1, 1>() ;break; case 0x8a: res<1, 2>() ;break; case 0x8b: res<1, 3>() ;break;
-            case 0x8c: res<1, 4>() ;break; case 0x8d: res<1, 5>() ;break; case 0x8e: res<1, 6>() ;break;
-            case 0x8f: res<1, 7>() ;break; case 0x90: res<2, 0>() ;break; case 0x91: res<2, 1>() ;break;
-            case 0x92: res<2, 2>() ;break; case 0x93: res<2, 3>() ;break; case 0x94: res<2, 4>() ;break;
-            case 0x95: res<2, 5>() ;break; case 0x96: res<2, 6>() ;break; case 0x97: res<2, 7>() ;break;
-            case 0x98: res<3, 0>() ;break; case 0x99: res<3, 1>() ;break; case 0x9a: res<3, 2>() ;break;
-            case 0x9b: res<3, 3>() ;break; case 0x9c: res<3, 4>() ;break; case 0x9d: res<3, 5>() ;break;
-            case 0x9e: res<3, 6>() ;break; case 0x9f: res<3, 7>() ;break; case 0xa0: res<4, 0>() ;break;
-            case 0xa1: res<4, 1>() ;break; case 0xa2: res<4, 2>() ;break; case 0xa3: res<4, 3>() ;break;
-            case 0xa4: res<4, 4>() ;break; case 0xa5: res<4, 5>() ;break; case 0xa6: res<4, 6>() ;break;
-            case 0xa7: res<4, 7>() ;break; case 0xa8: res<5, 0>() ;break; case 0xa9: res<5, 1>() ;break;
-            case 0xaa: res<5, 2>() ;break; case 0xab: res<5, 3>() ;break; case 0xac: res<5, 4>() ;break;
-            case 0xad: res<5, 5>() ;break; case 0xae: res<5, 6>() ;break; case 0xaf: res<5, 7>() ;break;
-            case 0xb0: res<6, 0>() ;break; case 0xb1: res<6, 1>() ;break; case 0xb2: res<6, 2>() ;break;
-            case 0xb3: res<6, 3>() ;break; case 0xb4: res<6, 4>() ;break; case 0xb5: res<6, 5>() ;break;
-            case 0xb6: res<6, 6>() ;break; case 0xb7: res<6, 7>() ;break; case 0xb8: res<7, 0>() ;break;
-            case 0xb9: res<7, 1>() ;break; case 0xba: res<7, 2>() ;break; case 0xbb: res<7, 3>() ;break;
-            case 0xbc: res<7, 4>() ;break; case 0xbd: res<7, 5>() ;break; case 0xbe: res<7, 6>() ;break;
-            case 0xbf: res<7, 7>() ;break;
-            case 0xc0: set<0, 0>() ;break; case 0xc1: set<0, 1>() ;break; case 0xc2: set<0, 2>() ;break;
-            case 0xc3: set<0, 3>() ;break; case 0xc4: set<0, 4>() ;break; case 0xc5: set<0, 5>() ;break;
-            case 0xc6: set<0, 6>() ;break; case 0xc7: set<0, 7>() ;break; case 0xc8: set<1, 0>() ;break;
-            case 0xc9: set<1, 1>() ;break; case 0xca: set<1, 2>() ;break; case 0xcb: set<1, 3>() ;break;
-            case 0xcc: set<1, 4>() ;break; case 0xcd: set<1, 5>() ;break; case 0xce: set<1, 6>() ;break;
-            case 0xcf: set<1, 7>() ;break; case 0xd0: set<2, 0>() ;break; case 0xd1: set<2, 1>() ;break;
-            case 0xd2: set<2, 2>() ;break; case 0xd3: set<2, 3>() ;break; case 0xd4: set<2, 4>() ;break;
-            case 0xd5: set<2, 5>() ;break; case 0xd6: set<2, 6>() ;break; case 0xd7: set<2, 7>() ;break;
-            case 0xd8: set<3, 0>() ;break; case 0xd9: set<3, 1>() ;break; case 0xda: set<3, 2>() ;break;
-            case 0xdb: set<3, 3>() ;break; case 0xdc: set<3, 4>() ;break; case 0xdd: set<3, 5>() ;break;
-            case 0xde: set<3, 6>() ;break; case 0xdf: set<3, 7>() ;break; case 0xe0: set<4, 0>() ;break;
-            case 0xe1: set<4, 1>() ;break; case 0xe2: set<4, 2>() ;break; case 0xe3: set<4, 3>() ;break;
-            case 0xe4: set<4, 4>() ;break; case 0xe5: set<4, 5>() ;break; case 0xe6: set<4, 6>() ;break;
-            case 0xe7: set<4, 7>() ;break; case 0xe8: set<5, 0>() ;break; case 0xe9: set<5, 1>() ;break;
-            case 0xea: set<5, 2>() ;break; case 0xeb: set<5, 3>() ;break; case 0xec: set<5, 4>() ;break;
-            case 0xed: set<5, 5>() ;break; case 0xee: set<5, 6>() ;break; case 0xef: set<5, 7>() ;break;
-            case 0xf0: set<6, 0>() ;break; case 0xf1: set<6, 1>() ;break; case 0xf2: set<6, 2>() ;break;
-            case 0xf3: set<6, 3>() ;break; case 0xf4: set<6, 4>() ;break; case 0xf5: set<6, 5>() ;break;
-            case 0xf6: set<6, 6>() ;break; case 0xf7: set<6, 7>() ;break; case 0xf8: set<7, 0>() ;break;
-            case 0xf9: set<7, 1>() ;break; case 0xfa: set<7, 2>() ;break; case 0xfb: set<7, 3>() ;break;
-            case 0xfc: set<7, 4>() ;break; case 0xfd: set<7, 5>() ;break; case 0xfe: set<7, 6>() ;break;
-            case 0xff: set<7, 7>() ;break;
-            default:
-                std::cout << "unimplemented " << op;
-        }
+        return regular_cycles[op] + taken;
     }
 
     template<u8 n_bit, u8 r>
@@ -427,6 +1358,10 @@ private:
         set_flag(Flag::Carry, !read_flag(Flag::Carry));
     }
 
+    void halt() {
+        halted = true;
+    }
+
     void stop() {
 //        throw std::runtime_error("Not implemented! (0x10 stop)");
     }
@@ -438,25 +1373,10 @@ private:
     }
 
     void daa() {
-        u8 reg = registers.a;
-        u16 correction = read_flag(Flag::Carry) ? 0x60 : 0x00;
-
-        if (read_flag(Flag::HalfCarry) || (!read_flag(Flag::Negative) && ((reg & 0x0F) > 9)))
-            correction |= 0x06;
-
-        if (read_flag(Flag::Carry) || (!read_flag(Flag::Negative) && (reg > 0x99)))
-            correction |= 0x60;
-
-        if (read_flag(Flag::Negative))
-            reg = static_cast<u8>(reg - correction);
-        else
-            reg = static_cast<u8>(reg + correction);
-
-        set_flag(Flag::Zero, reg == 0);
-        set_flag(Flag::HalfCarry, false);
-        set_flag(Flag::Carry, ((correction << 2) & 0x100) != 0);
-
-        registers.a = static_cast<u8>(reg);
+        materialize_flags();
+        u16 entry = daa_result(registers.a, registers.f);
+        registers.a = static_cast<u8>(entry);
+        registers.f = entry >> 8;
     }
 
     void ld_hl_sp_n() {
@@ -507,7 +1427,7 @@ private:
         registers.sp += n;
     }
 
-    template<u8 op, u8 r>
+    template<u8 op, u8 r, FlagOp kind = FlagOp::Rot>
     void rot() {
         u8 n = r_get<r>();
         bool carry = false;
@@ -539,10 +1459,14 @@ private:
             result = n >> 1;
         }
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, false);
-        set_flag(Flag::Carry, carry);
+        if constexpr (lazy_flags) {
+            defer_flags(kind, 0, result | (carry << 8));
+        } else {
+            set_flag(Flag::Zero, kind == FlagOp::Rot && CPU::is_result_zero(result));
+            set_flag(Flag::Negative, false);
+            set_flag(Flag::HalfCarry, false);
+            set_flag(Flag::Carry, carry);
+        }
 
         r_set<r>(result);
     }
@@ -558,10 +1482,11 @@ private:
         u16 x = registers.a + n;
         u8 result = static_cast<u8>(x);
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, CPU::is_carry_from_bit(3, registers.a, n));
-        set_flag(Flag::Carry, CPU::is_carry_from_bit(7, registers.a, n));
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Add, registers.a ^ n, x);
+        } else {
+            registers.f = alu_flags<false>(registers.a, n, false);
+        }
 
         registers.a = result;
     }
@@ -573,10 +1498,11 @@ private:
         u16 x = registers.a + n + carry;
         u8 result = static_cast<u8>(x);
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, CPU::is_carry_from_bit(3, registers.a, n, carry));
-        set_flag(Flag::Carry, CPU::is_carry_from_bit(7, registers.a, n, carry));
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Add, registers.a ^ n, x);
+        } else {
+            registers.f = alu_flags<false>(registers.a, n, carry);
+        }
 
         registers.a = result;
     }
@@ -586,10 +1512,11 @@ private:
         u8 n = r_get<r>();
         u8 result = registers.a - n;
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, true);
-        set_flag(Flag::HalfCarry, CPU::is_no_borrow_from_bit(4, registers.a, n));
-        set_flag(Flag::Carry, CPU::is_no_borrow_from_bit(8, registers.a, n));
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Sub, registers.a ^ n, registers.a - n);
+        } else {
+            registers.f = alu_flags<true>(registers.a, n, false);
+        }
 
         registers.a = result;
     }
@@ -600,10 +1527,11 @@ private:
         bool carry = read_flag(Flag::Carry);
         u8 result = registers.a - n - carry;
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, true);
-        set_flag(Flag::HalfCarry, CPU::is_no_borrow_from_bit(4, registers.a, n, carry));
-        set_flag(Flag::Carry, CPU::is_no_borrow_from_bit(8, registers.a, n, carry));
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Sub, registers.a ^ n, registers.a - n - carry);
+        } else {
+            registers.f = alu_flags<true>(registers.a, n, carry);
+        }
 
         registers.a = result;
     }
@@ -612,50 +1540,67 @@ private:
     void and_() {
         registers.a &= r_get<r>();
 
-        set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, true);
-        set_flag(Flag::Carry, false);
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::And, 0, registers.a);
+        } else {
+            set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
+            set_flag(Flag::Negative, false);
+            set_flag(Flag::HalfCarry, true);
+            set_flag(Flag::Carry, false);
+        }
     }
 
     template<u8 r>
     void xor_() {
         registers.a ^= r_get<r>();
 
-        set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, false);
-        set_flag(Flag::Carry, false);
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Or, 0, registers.a);
+        } else {
+            set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
+            set_flag(Flag::Negative, false);
+            set_flag(Flag::HalfCarry, false);
+            set_flag(Flag::Carry, false);
+        }
     }
 
     template<u8 r>
     void or_() {
         registers.a |= r_get<r>();
 
-        set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, false);
-        set_flag(Flag::Carry, false);
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Or, 0, registers.a);
+        } else {
+            set_flag(Flag::Zero, CPU::is_result_zero(registers.a));
+            set_flag(Flag::Negative, false);
+            set_flag(Flag::HalfCarry, false);
+            set_flag(Flag::Carry, false);
+        }
     }
 
     template<u8 r>
     void cp() {
         u8 n = r_get<r>();
-        set_flag(Flag::Zero, registers.a == n);
-        set_flag(Flag::Negative, true);
-        set_flag(Flag::HalfCarry, CPU::is_no_borrow_from_bit(4, registers.a, n));
-        set_flag(Flag::Carry, CPU::is_no_borrow_from_bit(8, registers.a, n));
+        if constexpr (lazy_flags) {
+            defer_flags(FlagOp::Sub, registers.a ^ n, registers.a - n);
+        } else {
+            registers.f = alu_flags<true>(registers.a, n, false);
+        }
     }
 
     template<u8 p>
     void push_nn() {
+        if constexpr (p == 3)
+            materialize_flags();
         push(rp2<p>());
     }
 
     template<u8 p>
     void pop_nn() {
-        if constexpr(p == 3) // ignore 0-3 bit in AF
+        if constexpr(p == 3) { // ignore 0-3 bit in AF
             rp2<p>() = pop() & 0xFFF0;
+            lazy.op = FlagOp::None;
+        }
         else
             rp2<p>() = pop();
     }
@@ -665,9 +1610,12 @@ private:
     }
 
     template<u8 c>
-    void ret_cc() {
-        if (condition_checks<c>())
-            registers.pc = pop();
+    size_t ret_cc() {
+        if (!condition_checks<c>())
+            return 0;
+
+        registers.pc = pop();
+        return 12;
     }
 
     void reti() {
@@ -694,13 +1642,15 @@ private:
     }
 
     template<u8 c>
-    void call_cc_nn() {
+    size_t call_cc_nn() {
         u16 nn = read_u16();
 
-        if (condition_checks<c>()) {
-            push(registers.pc);
-            registers.pc = nn;
-        }
+        if (!condition_checks<c>())
+            return 0;
+
+        push(registers.pc);
+        registers.pc = nn;
+        return 12;
     }
 
     void ldh_n_a() {
@@ -729,10 +1679,11 @@ private:
 
     void di() {
         interrupt_enabled = false;
+        enable_interrupts = false;
     }
 
     void ei() {
-        interrupt_enabled = true;
+        enable_interrupts = true;
     }
 
     void jp_nn() {
@@ -744,15 +1695,18 @@ private:
     }
 
     template<u8 c, bool relative = false>
-    void j_cc_n() {
-        std::conditional_t<relative, s8, u8> n;
+    size_t j_cc_n() {
+        u16 target;
         if constexpr(relative)
-            n = read_s8();
+            target = read_s8() + registers.pc; // relative to the next instruction
         else
-            n = read_u8();
+            target = read_u16();
 
-        if (condition_checks<c>())
-            registers.pc += n;
+        if (!condition_checks<c>())
+            return 0;
+
+        registers.pc = target;
+        return 4;
     }
 
     template<u8 c>
@@ -768,16 +1722,54 @@ private:
     }
 
     inline bool read_flag(Flag f) const {
-        return registers.f & static_cast<u8>(f);
+        return flags() & static_cast<u8>(f);
+    }
+
+    // f as the eager flags would have left it
+    u8 flags() const {
+        if constexpr (!lazy_flags)
+            return registers.f;
+
+        u8 z = static_cast<u8>(lazy.result) ? 0 : 0x80;
+        u8 h = (lazy.operands ^ lazy.result) & 0x10 ? 0x20 : 0;
+        u8 c = lazy.result & 0x100 ? 0x10 : 0;
+        switch (lazy.op) {
+            case FlagOp::Add: return z | h | c;
+            case FlagOp::Sub: return z | 0x40 | h | c;
+            case FlagOp::And: return z | 0x20;
+            case FlagOp::Or: return z;
+            case FlagOp::Inc: return z | (lazy.result & 0xf ? 0 : 0x20) | (registers.f & 0x10);
+            case FlagOp::Dec: return z | 0x40 | ((lazy.result & 0xf) == 0xf ? 0x20 : 0) | (registers.f & 0x10);
+            case FlagOp::Rot: return z | c;
+            case FlagOp::RotA: return c;
+            default: return registers.f;
+        }
+    }
+
+    void materialize_flags() {
+        if constexpr (lazy_flags) {
+            registers.f = flags();
+            lazy.op = FlagOp::None;
+        }
+    }
+
+    void defer_flags(FlagOp op, u8 operands, u16 result) {
+        lazy = {op, operands, static_cast<u16>(result & 0x1ff)};
     }
 
     template <u8 r>
     void inc_r() {
         u8 result = r_get<r>() + 1;
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, false);
-        set_flag(Flag::HalfCarry, CPU::is_carry_from_bit(3, r_get<r>(), 1));
+        if constexpr (lazy_flags) {
+            if (lazy.op != FlagOp::Inc && lazy.op != FlagOp::Dec) // C stays, so f has to hold it
+                materialize_flags();
+            defer_flags(FlagOp::Inc, 0, result);
+        } else {
+            set_flag(Flag::Zero, CPU::is_result_zero(result));
+            set_flag(Flag::Negative, false);
+            set_flag(Flag::HalfCarry, CPU::is_carry_from_bit(3, r_get<r>(), 1));
+        }
 
         r_set<r>(result);
     }
@@ -786,9 +1778,15 @@ private:
     void dec_r() {
         u8 result = r_get<r>() - 1;
 
-        set_flag(Flag::Zero, CPU::is_result_zero(result));
-        set_flag(Flag::Negative, true);
-        set_flag(Flag::HalfCarry, CPU::is_no_borrow_from_bit(4, r_get<r>()));
+        if constexpr (lazy_flags) {
+            if (lazy.op != FlagOp::Inc && lazy.op != FlagOp::Dec)
+                materialize_flags();
+            defer_flags(FlagOp::Dec, 0, result);
+        } else {
+            set_flag(Flag::Zero, CPU::is_result_zero(result));
+            set_flag(Flag::Negative, true);
+            set_flag(Flag::HalfCarry, CPU::is_no_borrow_from_bit(4, r_get<r>()));
+        }
 
         r_set<r>(result);
     }
@@ -915,13 +1913,19 @@ private:
             return registers.hl;
     }
 
+    // the ops that leave some flags alone go through here, lazy ones are worked out first
     void set_flag(Flag f, bool b) {
+        materialize_flags();
         if (b)
             registers.f |= static_cast<u8>(f);
         else
             registers.f &= ~static_cast<u8>(f);
     }
 
+    static constexpr u8 flag(Flag f, bool b) {
+        return b ? static_cast<u8>(f) : 0;
+    }
+
     static inline bool is_result_zero(u8 b) {
         return b == 0;
     }
@@ -945,6 +1949,11 @@ private:
     }
 
     u8 read_u8() {
+        if (prefetched) {
+            registers.pc++;
+            return *prefetched++;
+        }
+
         auto op = mmu.read(registers.pc);
         registers.pc++;
         return op;
@@ -962,8 +1971,4 @@ private:
         return static_cast<u16>((high << 8) | low);
     }
 
-    static size_t cycles(u8 op) {
-        return 4;
-    }
-
 };
@@ -1,9 +1,13 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 
 using u8 = std::uint8_t;
 using u16 = std::uint16_t;
 using u32 = std::uint32_t;
+using u64 = std::uint64_t;
 using s8 = std::int8_t;
+using s64 = std::int64_t;
 
 const size_t CLOCK_FREQUENCY = 4194304;
 const float FRAMERATE = 59.63;
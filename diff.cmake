@@ -0,0 +1,24 @@
+# cmake -DREFERENCE=<gbemuz-diff> -DVARIANT=<gbemuz-diff-...> -P diff.cmake
+# runs both and fails on the lines their outputs differ in
+cmake_minimum_required(VERSION 3.20)
+foreach (program REFERENCE VARIANT)
+    execute_process(COMMAND ${${program}} OUTPUT_VARIABLE output RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${${program}} exited with ${result}")
+    endif ()
+    string(REPLACE "\n" ";" ${program}_lines "${output}")
+endforeach ()
+
+if (NOT REFERENCE_lines STREQUAL VARIANT_lines)
+    foreach (line IN LISTS REFERENCE_lines)
+        if (NOT line IN_LIST VARIANT_lines)
+            message(STATUS "default: ${line}")
+        endif ()
+    endforeach ()
+    foreach (line IN LISTS VARIANT_lines)
+        if (NOT line IN_LIST REFERENCE_lines)
+            message(STATUS "variant: ${line}")
+        endif ()
+    endforeach ()
+    message(FATAL_ERROR "${VARIANT} differs from ${REFERENCE}")
+endif ()
@@ -0,0 +1,253 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "gbemuz.hpp"
+
+// gbemuz-diff [check...], all of them when none is named. prints a digest of what the cpu does, one
+// line per check. built once with the default options and once for each option that changes how the
+// cpu gets its results (lazy flags, alu helpers, no fusion, switch dispatch) or hooks into every
+// instruction (profiling), diff.cmake runs the default build and one of the others and fails on any
+// line that differs
+
+namespace {
+
+// fnv-1a
+struct Digest {
+    u64 value = 1469598103934665603ull;
+
+    void add(const void* data, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            value = (value ^ static_cast<const u8*>(data)[i]) * 1099511628211ull;
+    }
+
+    template<typename T>
+    void add(const T& v) {
+        add(&v, sizeof v);
+    }
+};
+
+// through a file of its own, variants run side by side
+std::shared_ptr<const RomImage> open_rom(const std::string& name, const std::vector<u8>& bytes) {
+    auto path = std::filesystem::temp_directory_path()
+                / ("gbemuz-diff-" + name + "-" + std::to_string(getpid()) + ".gb");
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    auto image = RomImage::open(path.string());
+    std::filesystem::remove(path);
+    return image;
+}
+
+struct Instruction {
+    const char* name;
+    u8 code[2];
+    bool reads_a;
+    bool reads_b;
+
+    size_t length() const { return code[0] == 0xcb ? 2 : 1; }
+};
+
+constexpr Instruction instructions[] = {
+    {"add a, b", {0x80}, true, true},
+    {"adc a, b", {0x88}, true, true},
+    {"sub b", {0x90}, true, true},
+    {"sbc a, b", {0x98}, true, true},
+    {"and b", {0xa0}, true, true},
+    {"xor b", {0xa8}, true, true},
+    {"or b", {0xb0}, true, true},
+    {"cp b", {0xb8}, true, true},
+    {"inc b", {0x04}, false, true},
+    {"dec b", {0x05}, false, true},
+    {"inc a", {0x3c}, true, false},
+    {"dec a", {0x3d}, true, false},
+    {"rlca", {0x07}, true, false},
+    {"rrca", {0x0f}, true, false},
+    {"rla", {0x17}, true, false},
+    {"rra", {0x1f}, true, false},
+    {"rlc b", {0xcb, 0x00}, false, true},
+    {"rrc b", {0xcb, 0x08}, false, true},
+    {"rl b", {0xcb, 0x10}, false, true},
+    {"rr b", {0xcb, 0x18}, false, true},
+    {"sla b", {0xcb, 0x20}, false, true},
+    {"sra b", {0xcb, 0x28}, false, true},
+    {"swap b", {0xcb, 0x30}, false, true},
+    {"srl b", {0xcb, 0x38}, false, true},
+    {"daa", {0x27}, true, false},
+    {"cpl", {0x2f}, true, false},
+    {"scf", {0x37}, false, false},
+    {"ccf", {0x3f}, false, false},
+};
+
+// every a, b and flags the instruction reads. it runs from a loaded state, where f is plain, then
+// again and then the next one in the list follows, both on the flags it left, which are the lazy
+// ones with GBEMUZ_LAZY_FLAGS
+void alu() {
+    std::vector<u8> rom(0x8000);
+    rom[0x100] = 0x18; // jr to itself
+    rom[0x101] = 0xfe;
+    GameBoy gb(open_rom("alu", rom), CPU::Mode::Interpreter);
+
+    constexpr size_t count = sizeof instructions / sizeof instructions[0];
+    for (size_t i = 0; i < count; i++) {
+        const Instruction& x = instructions[i];
+        const Instruction& next = instructions[(i + 1) % count];
+        u16 address = 0xc000;
+        for (const Instruction* in : {&x, &x, &next})
+            for (size_t k = 0; k < in->length(); k++)
+                gb.mmu.write(address++, in->code[k]);
+
+        CPU::State state;
+        gb.cpu.save(state);
+        Digest digest;
+        for (unsigned a = 0; a < (x.reads_a ? 0x100 : 1); a++) {
+            for (unsigned b = 0; b < (x.reads_b ? 0x100 : 1); b++) {
+                for (unsigned f = 0; f < 0x100; f += 0x10) {
+                    state.registers.a = a;
+                    state.registers.b = b;
+                    state.registers.f = f;
+                    state.registers.pc = 0xc000;
+                    gb.cpu.load(state);
+                    for (int step = 0; step < 3; step++) {
+                        digest.add(gb.cpu.step());
+                        CPU::State out;
+                        gb.cpu.save(out);
+                        digest.add(out.registers);
+                    }
+                }
+            }
+        }
+        std::cout << x.name << ": " << digest.value << std::endl;
+    }
+}
+
+// instructions a random block can be made of: nothing writing h, l or sp, so (hl) stays in wram and
+// the stack where it is, nothing halting or leaving the block
+std::vector<u8> random_instruction(std::mt19937& rng) {
+    for (;;) {
+        u8 op = rng();
+        auto n = [&] { return static_cast<u8>(rng()); };
+        if (op >= 0x40 && op < 0x80) { // ld r, r' but not into h or l, and not halt
+            if (op == 0x76 || (op >= 0x60 && op < 0x70))
+                continue;
+            return {op};
+        }
+        if (op >= 0x80 && op < 0xc0)
+            return {op};
+        switch (op) {
+            case 0x03: case 0x04: case 0x05: case 0x07: case 0x0b: case 0x0c: case 0x0d: case 0x0f:
+            case 0x13: case 0x14: case 0x15: case 0x17: case 0x1b: case 0x1c: case 0x1d: case 0x1f:
+            case 0x27: case 0x2f: case 0x34: case 0x35: case 0x37: case 0x3c: case 0x3d: case 0x3f:
+                return {op};
+            case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x36: case 0x3e:
+            case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+                return {op, n()};
+            case 0xcb: {
+                u8 cb = rng();
+                if ((cb & 7) == 4 || (cb & 7) == 5)
+                    continue;
+                return {op, cb};
+            }
+            case 0xc5: case 0xd5: case 0xf5: { // push, popped again into bc, de or af
+                static constexpr u8 pops[] = {0xc1, 0xd1, 0xf1};
+                return {op, pops[rng() % 3]};
+            }
+            default:
+                continue;
+        }
+    }
+}
+
+// copy loops, countdowns and ly polls the block cache fuses, between blocks of random instructions
+// with taken and not taken branches, and a vblank handler coming in anywhere
+std::vector<u8> program(u32 seed) {
+    std::vector<u8> rom(0x8000);
+    std::mt19937 rng(seed);
+    for (size_t i = 0x4000; i < 0x8000; i++)
+        rom[i] = rng();
+
+    auto put = [&](u16 address, std::initializer_list<u8> code) {
+        for (u8 b : code)
+            rom[address++] = b;
+    };
+    put(0x40, {0xf5, 0xfa, 0x00, 0xc9, 0x3c, 0xea, 0x00, 0xc9, 0xf1, 0xd9}); // count vblanks at 0xc900
+    put(0x100, {0x00, 0xc3, 0x50, 0x01});
+    put(0x150, {
+        0x31, 0xfe, 0xdf, // ld sp, 0xdffe
+        0x3e, 0x01, 0xe0, 0xff, 0xfb, // vblank on, ei
+        0x21, 0x00, 0x40, 0x11, 0x00, 0xc0, 0x01, 0x00, 0x04, // ld hl, 0x4000  ld de, 0xc000  ld bc, 0x400
+        0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20, 0xf8, // copy, inc de first
+        0x01, 0x00, 0x01, // ld bc, 0x100
+        0x2a, 0x12, 0x0b, 0x13, 0x78, 0xb1, 0x20, 0xf8, // copy, dec bc first
+        0x0e, 0x08, 0x06, 0x40, 0x05, 0x20, 0xfd, 0x0d, 0x20, 0xf8, // countdowns
+        0xf0, 0x44, 0xfe, 0x90, 0x20, 0xfa, // wait for ly 144
+        0x21, 0x00, 0xc8, 0xcd, 0x00, 0x10, // ld hl, 0xc800  call 0x1000
+        0x21, 0x00, 0xc8, 0xcd, 0x00, 0x20, // and 0x2000
+        0xc3, 0x58, 0x01, // back to the copies
+    });
+
+    for (u16 start : {0x1000, 0x2000}) {
+        size_t pc = start;
+        for (int i = 0; i < 400; i++) {
+            std::vector<u8> code = random_instruction(rng);
+            if (rng() % 8 == 0) { // jr cc over it
+                rom[pc++] = 0x20 + 8 * (rng() % 4);
+                rom[pc++] = code.size();
+            }
+            for (u8 b : code)
+                rom[pc++] = b;
+        }
+        rom[pc] = 0xc9; // ret
+    }
+    return rom;
+}
+
+// a few random programs in every mode, registers, wram and the time at the end of each frame
+void programs() {
+    for (u32 seed : {1, 2, 3}) {
+        auto rom = open_rom("program-" + std::to_string(seed), program(seed));
+        for (auto mode : {CPU::Mode::Interpreter, CPU::Mode::BlockCache, CPU::Mode::Jit}) {
+            GameBoy gb(rom, mode);
+            gb.ppu.set_render(false);
+            auto mmu = std::make_unique<MMU::State>();
+            Digest digest;
+            for (int frame = 0; frame < 300; frame++) {
+                gb.run(u64(CYCLES_PER_FRAME));
+                CPU::State cpu;
+                gb.cpu.save(cpu);
+                gb.mmu.save(*mmu);
+                digest.add(cpu.registers);
+                digest.add(mmu->wram);
+                digest.add(gb.scheduler.now);
+            }
+            std::cout << "program " << seed << " mode " << static_cast<int>(mode) << ": " << digest.value
+                      << std::endl;
+        }
+    }
+}
+
+struct Check {
+    const char* name;
+    void (*run)();
+};
+
+constexpr Check checks[] = {
+    {"alu", alu},
+    {"programs", programs},
+};
+
+}
+
+int main(int argc, char** argv) {
+    for (const Check& c : checks) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++)
+            selected |= std::strcmp(argv[i], c.name) == 0;
+        if (selected)
+            c.run();
+    }
+    return 0;
+}
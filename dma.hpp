@@ -0,0 +1,45 @@
+#pragma once
+#include "mmu.hpp"
+#include "scheduler.hpp"
+
+// oam dma, the copy is done up front and the event only marks the end of the transfer
+class Dma : public IoDevice {
+public:
+    Dma(MMU& mmu, Scheduler& scheduler) : mmu(mmu), scheduler(scheduler) {
+        mmu.attach(*this, 0xff46, 0xff46);
+    }
+
+    u8 io_read(u16) override { return source; }
+
+    void io_write(u16, u8 value) override {
+        source = value;
+        for (u16 i = 0; i < 0xa0; i++)
+            mmu.write(0xfe00 + i, mmu.read((value << 8) + i));
+
+        active = true;
+        scheduler.schedule_in(Event::DmaEnd, 0xa0 * 4);
+    }
+
+    // Event::DmaEnd
+    void end() { active = false; }
+
+    bool running() const { return active; }
+
+    struct State {
+        u8 source;
+        bool active;
+    };
+
+    void save(State& state) const { state = {source, active}; }
+
+    void load(const State& state) {
+        source = state.source;
+        active = state.active;
+    }
+
+private:
+    MMU& mmu;
+    Scheduler& scheduler;
+    u8 source = 0;
+    bool active = false;
+};
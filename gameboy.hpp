@@ -0,0 +1,160 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "dma.hpp"
+#include "joypad.hpp"
+#include "mmu.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "serial.hpp"
+#include "timer.hpp"
+
+// everything wired together. the cpu runs freely up to the next event, then the events due get handled
+class GameBoy {
+public:
+    explicit GameBoy(const std::string& filepath, CPU::Mode mode = CPU::Mode::BlockCache,
+                     PPU::Accuracy accuracy = PPU::Accuracy::Scanline)
+        : cart(filepath), mmu(cart), cpu(mmu, scheduler, mode), timer(mmu, scheduler), serial(mmu, scheduler),
+          dma(mmu, scheduler), ppu(mmu, scheduler, accuracy), joypad(mmu) {
+        cart.set_clock(&scheduler.now);
+        if (cart.has_save())
+            scheduler.schedule_in(Event::SaveFlush, save_interval);
+    }
+
+    // a rom opened once and shared by any number of instances, battery ram only lives in memory
+    explicit GameBoy(std::shared_ptr<const RomImage> image, CPU::Mode mode = CPU::Mode::BlockCache,
+                     PPU::Accuracy accuracy = PPU::Accuracy::Scanline)
+        : cart(std::move(image)), mmu(cart), cpu(mmu, scheduler, mode), timer(mmu, scheduler),
+          serial(mmu, scheduler), dma(mmu, scheduler), ppu(mmu, scheduler, accuracy), joypad(mmu) {
+        cart.set_clock(&scheduler.now);
+    }
+
+    // the save file gets the rtc as it is now, while the clock it reads is still there
+    ~GameBoy() { cart.flush(); }
+
+    GameBoy(const GameBoy&) = delete;
+    GameBoy& operator=(const GameBoy&) = delete;
+
+    void run(u64 cycles) {
+        u64 until = scheduler.now + cycles;
+
+        while (scheduler.now < until) {
+            cpu.run(until);
+            dispatch();
+        }
+    }
+
+    // runs on until the next whole frame has been drawn, for frontends that skip frames or do not
+    // draw at all. gives up after two frames of the lcd staying off
+    void run_until_drawn() {
+        ppu.request_frame();
+        u64 drawn = ppu.frames_drawn();
+        for (u64 limit = scheduler.now + 2 * 154 * 456; ppu.frames_drawn() == drawn && scheduler.now < limit;)
+            run(456);
+    }
+
+    // fixed layout snapshot, the cartridge ram follows it. bump version whenever a State changes
+    struct State {
+        static constexpr u32 magic_value = 0x535a4247; // "GBZS"
+        static constexpr u32 version_value = 6;
+
+        u32 magic;
+        u32 version;
+        u32 size; // sizeof(State), catches a layout change that forgot the version
+        u32 ram_bytes;
+        u16 checksum;
+        Scheduler::State scheduler;
+        CPU::State cpu;
+        MMU::State mmu;
+        Cartrigde::State cart;
+        Timer::State timer;
+        Serial::State serial;
+        Dma::State dma;
+        PPU::State ppu;
+        Joypad::State joypad;
+    };
+
+    static_assert(std::is_trivially_copyable_v<State>);
+
+    // bytes needed by save_state for this cartridge
+    size_t state_size() const { return sizeof(State) + cart.ram_bytes(); }
+
+    // into a caller buffer aligned for State, nothing gets allocated. false when it does not fit
+    bool save_state(void* buffer, size_t size) const {
+        if (size < state_size() || reinterpret_cast<std::uintptr_t>(buffer) % alignof(State))
+            return false;
+
+        auto& state = *static_cast<State*>(buffer);
+        state.magic = State::magic_value;
+        state.version = State::version_value;
+        state.size = sizeof(State);
+        state.ram_bytes = cart.ram_bytes();
+        state.checksum = cart.checksum();
+        scheduler.save(state.scheduler);
+        cpu.save(state.cpu);
+        mmu.save(state.mmu);
+        cart.save(state.cart, static_cast<u8*>(buffer) + sizeof(State));
+        timer.save(state.timer);
+        serial.save(state.serial);
+        dma.save(state.dma);
+        ppu.save(state.ppu);
+        joypad.save(state.joypad);
+        return true;
+    }
+
+    // false, with nothing changed, for a state of another version, rom or cartridge ram size
+    bool load_state(const void* buffer, size_t size) {
+        if (size < sizeof(State) || reinterpret_cast<std::uintptr_t>(buffer) % alignof(State))
+            return false;
+
+        const auto& state = *static_cast<const State*>(buffer);
+        if (state.magic != State::magic_value || state.version != State::version_value
+            || state.size != sizeof(State) || state.ram_bytes != cart.ram_bytes()
+            || state.checksum != cart.checksum() || size < state_size())
+            return false;
+
+        cart.load(state.cart, static_cast<const u8*>(buffer) + sizeof(State));
+        mmu.load(state.mmu);
+        scheduler.load(state.scheduler);
+        cpu.load(state.cpu);
+        timer.load(state.timer);
+        serial.load(state.serial);
+        dma.load(state.dma);
+        ppu.load(state.ppu);
+        joypad.load(state.joypad);
+        return true;
+    }
+
+    Cartrigde cart;
+    Scheduler scheduler;
+    MMU mmu;
+    CPU cpu;
+    Timer timer;
+    Serial serial;
+    Dma dma;
+    PPU ppu;
+    Joypad joypad;
+
+private:
+    // battery ram written in the last emulated second reaches the disk in one batch
+    static constexpr u64 save_interval = CLOCK_FREQUENCY;
+
+    void dispatch() {
+        for (Event event = scheduler.pop_due(); event != Event::Count; event = scheduler.pop_due()) {
+            switch (event) {
+                case Event::TimerOverflow: timer.overflow(); break;
+                case Event::LcdMode: ppu.mode_change(); break;
+                case Event::SerialTransfer: serial.transfer_complete(); break;
+                case Event::DmaEnd: dma.end(); break;
+                case Event::SaveFlush:
+                    cart.flush();
+                    scheduler.schedule_in(Event::SaveFlush, save_interval);
+                    break;
+                default: break;
+            }
+        }
+    }
+};
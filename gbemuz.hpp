@@ -0,0 +1,11 @@
+#pragma once
+// everything a program embedding the emulator needs, link against gbemuz::core
+#include <iostream>
+
+#include "definitions.hpp"
+#include "gameboy.hpp"
+#include "link.hpp"
+#include "pool.hpp"
+#include "rewind.hpp"
+#include "rom.hpp"
+#include "runahead.hpp"
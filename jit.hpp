@@ -0,0 +1,180 @@
+#pragma once
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define GBEMUZ_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define GBEMUZ_JIT 0
+#endif
+
+#if GBEMUZ_JIT
+
+// executable memory, handed out linearly and only ever reset as a whole. mapped on the first
+// place(), so cpus that never translate anything never take any, and never writable and executable
+// at once: the pages new code goes to are writable for the copy only
+class CodeArena {
+public:
+    explicit CodeArena(size_t size = 4 << 20) : size(size) {}
+
+    ~CodeArena() {
+        if (memory)
+            munmap(memory, size);
+    }
+
+    CodeArena(const CodeArena&) = delete;
+    CodeArena& operator=(const CodeArena&) = delete;
+
+    // until mapping or protecting it failed once
+    bool usable() const { return !failed; }
+
+    // nullptr when full, the caller is expected to reset() and recompile
+    void* place(const std::vector<u8>& code) {
+        if (!map() || used + code.size() > size)
+            return nullptr;
+
+        u8* at = memory + used;
+        size_t page = sysconf(_SC_PAGESIZE);
+        u8* first = memory + used / page * page;
+        size_t length = at + code.size() - first;
+        if (mprotect(first, length, PROT_READ | PROT_WRITE) != 0) {
+            failed = true;
+            return nullptr;
+        }
+        std::memcpy(at, code.data(), code.size());
+        if (mprotect(first, length, PROT_READ | PROT_EXEC) != 0) {
+            failed = true;
+            return nullptr;
+        }
+
+        used += (code.size() + 15) & ~size_t(15);
+        return at;
+    }
+
+    void reset() { used = 0; }
+
+    // bytes mapped, none before the first place()
+    size_t reserved() const { return memory ? size : 0; }
+
+private:
+    u8* memory = nullptr;
+    size_t size;
+    size_t used = 0;
+    bool failed = false;
+
+    bool map() {
+        if (memory || failed)
+            return !failed;
+
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            failed = true;
+        else
+            memory = static_cast<u8*>(p);
+        return !failed;
+    }
+};
+
+// just the handful of x86-64 encodings the translator needs. rbx holds the registers struct,
+// r12 the lahf -> F table and r13 the cpu; al/cl/dl are scratch
+class X64Emitter {
+public:
+    enum Reg8 : u8 { al = 0, cl = 1, dl = 2, ah = 4, dh = 6 };
+
+    std::vector<u8> code;
+
+    void prologue() {
+        emit({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13
+        emit({0x48, 0x89, 0xf3}); // mov rbx, rsi
+        emit({0x49, 0x89, 0xd4}); // mov r12, rdx
+        emit({0x49, 0x89, 0xfd}); // mov r13, rdi
+    }
+
+    void epilogue(u32 result) {
+        mov_eax(result);
+        emit({0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3}); // pop r13; pop r12; pop rbx; ret
+    }
+
+    static constexpr u8 epilogue_size = 11;
+
+    // returns eax + extra
+    void epilogue_add(u32 extra) {
+        emit({0x05}); imm32(extra); // add eax, extra
+        emit({0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+    }
+
+    void load(Reg8 r, u8 disp) { emit({0x8a, modrm_rbx(r), disp}); }
+    void store(u8 disp, Reg8 r) { emit({0x88, modrm_rbx(r), disp}); }
+    void store_imm8(u8 disp, u8 imm) { emit({0xc6, 0x43, disp, imm}); }
+    void store_imm16(u8 disp, u16 imm) { emit({0x66, 0xc7, 0x43, disp, u8(imm), u8(imm >> 8)}); }
+    void and_mem_imm8(u8 disp, u8 imm) { emit({0x80, 0x63, disp, imm}); }
+    void or_mem_imm8(u8 disp, u8 imm) { emit({0x80, 0x4b, disp, imm}); }
+    void inc_mem16(u8 disp) { emit({0x66, 0xff, 0x43, disp}); }
+    void dec_mem16(u8 disp) { emit({0x66, 0xff, 0x4b, disp}); }
+    void mov_imm8(Reg8 r, u8 imm) { emit({u8(0xb0 + r), imm}); }
+
+    // op al, cl with the 00/08/10/18/20/28/30/38 family opcodes (add, or, adc, sbb, and, sub, xor, cmp)
+    void alu_al_cl(u8 opcode) { emit({opcode, 0xc8}); }
+    void and_imm8(Reg8 r, u8 imm) { emit({0x80, u8(0xe0 + r), imm}); }
+    void or_imm8(Reg8 r, u8 imm) { emit({0x80, u8(0xc8 + r), imm}); }
+    void xor_imm8(Reg8 r, u8 imm) { emit({0x80, u8(0xf0 + r), imm}); }
+    void or_r8(Reg8 dst, Reg8 src) { emit({0x08, u8(0xc0 | (src << 3) | dst)}); }
+    void not_r8(Reg8 r) { emit({0xf6, u8(0xd0 + r)}); }
+    void inc_r8(Reg8 r) { emit({0xfe, u8(0xc0 + r)}); }
+    void dec_r8(Reg8 r) { emit({0xfe, u8(0xc8 + r)}); }
+    void test_imm8(Reg8 r, u8 imm) { emit({0xf6, u8(0xc0 + r), imm}); }
+    void test_r8(Reg8 r) { emit({0x84, u8(0xc0 | (r << 3) | r)}); }
+
+    // /n of the d0/c0 shift group: 0 rol, 1 ror, 2 rcl, 3 rcr, 4 shl, 5 shr, 7 sar
+    void shift1(u8 n, Reg8 r) { emit({0xd0, u8(0xc0 | (n << 3) | r)}); }
+    void shift(u8 n, Reg8 r, u8 count) { emit({0xc0, u8(0xc0 | (n << 3) | r), count}); }
+
+    void setc(Reg8 r) { emit({0x0f, 0x92, u8(0xc0 + r)}); }
+    void setz(Reg8 r) { emit({0x0f, 0x94, u8(0xc0 + r)}); }
+
+    // dl = table[ah] after lahf
+    void lahf_flags() {
+        emit({0x9f}); // lahf
+        emit({0x0f, 0xb6, 0xd4}); // movzx edx, ah
+        emit({0x41, 0x0f, 0xb6, 0x14, 0x14}); // movzx edx, byte [r12 + rdx]
+    }
+
+    // fn(r13, ptr, a, b), returning in eax
+    void call(const void* fn, const void* ptr, u32 a, u32 b) {
+        emit({0x4c, 0x89, 0xef}); // mov rdi, r13
+        emit({0x48, 0xbe}); imm64(ptr); // mov rsi, ptr
+        emit({0xba}); imm32(a); // mov edx, a
+        emit({0xb9}); imm32(b); // mov ecx, b
+        emit({0x48, 0xb8}); imm64(fn); // mov rax, fn
+        emit({0xff, 0xd0}); // call rax
+    }
+
+    // if eax != 0 return result
+    void exit_if_eax(u32 result) {
+        emit({0x85, 0xc0}); // test eax, eax
+        emit({0x74, epilogue_size}); // jz over the epilogue
+        epilogue(result);
+    }
+
+private:
+    void emit(std::initializer_list<u8> bytes) { code.insert(code.end(), bytes); }
+
+    static u8 modrm_rbx(Reg8 r) { return 0x43 | (r << 3); } // [rbx + disp8]
+
+    void mov_eax(u32 v) { emit({0xb8}); imm32(v); }
+
+    void imm32(u32 v) {
+        for (int i = 0; i < 4; i++)
+            code.push_back(v >> (8 * i));
+    }
+
+    void imm64(const void* p) {
+        auto v = reinterpret_cast<std::uintptr_t>(p);
+        for (int i = 0; i < 8; i++)
+            code.push_back(v >> (8 * i));
+    }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include "mmu.hpp"
+
+// ff00, the frontend sets which buttons are held and the game picks a row to read
+class Joypad : public IoDevice {
+public:
+    enum Button : u8 {
+        Right = 1 << 0,
+        Left = 1 << 1,
+        Up = 1 << 2,
+        Down = 1 << 3,
+        A = 1 << 4,
+        B = 1 << 5,
+        Select = 1 << 6,
+        Start = 1 << 7,
+    };
+
+    explicit Joypad(MMU& mmu) : mmu(mmu) {
+        mmu.attach(*this, 0xff00, 0xff00);
+    }
+
+    // pressed bits are active low, bit 4 low selects the directions and bit 5 low the buttons
+    u8 io_read(u16) override {
+        u8 low = 0x0f;
+        if (!(select & 0x10))
+            low &= ~(held & 0x0f);
+        if (!(select & 0x20))
+            low &= ~(held >> 4);
+        return 0xc0 | select | low;
+    }
+
+    void io_write(u16, u8 value) override { select = value & 0x30; }
+
+    // buttons is a mask of Button, any newly pressed one raises the interrupt
+    void set(u8 buttons) {
+        if (buttons & ~held)
+            mmu.request_interrupt(Interrupt::Joypad);
+        held = buttons;
+    }
+
+    u8 buttons() const { return held; }
+
+    struct State {
+        u8 select;
+        u8 held;
+    };
+
+    void save(State& state) const { state = {select, held}; }
+
+    void load(const State& state) {
+        select = state.select;
+        held = state.held;
+    }
+
+private:
+    MMU& mmu;
+    u8 select = 0; // reads 0xcf after boot
+    u8 held = 0;
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "gameboy.hpp"
+
+// two instances wired through their serial ports, each run on its own thread. they are kept within
+// quantum cycles of each other rather than in lock step, and only meet when a byte goes across:
+// the end clocking it out waits until it knows whether the other was ready at that cycle, and an
+// end waiting on the external clock stays behind the other so the byte lands on time. where the
+// host threads happen to be never shows, two runs of the same pair go the same way
+class LinkCable {
+public:
+    LinkCable(GameBoy& a, GameBoy& b, u64 quantum = 4 * Serial::transfer_cycles)
+        : ends{End(*this, a, 0), End(*this, b, 1)}, quantum(std::max<u64>(quantum, 2)) {
+        a.serial.connect(&ends[0]);
+        b.serial.connect(&ends[1]);
+    }
+
+    ~LinkCable() {
+        for (End& end : ends)
+            end.gb.serial.connect(nullptr);
+    }
+
+    LinkCable(const LinkCable&) = delete;
+    LinkCable& operator=(const LinkCable&) = delete;
+
+    // runs both for cycles, returns when both are done
+    void run(u64 cycles) {
+        for (End& end : ends) {
+            end.start = end.gb.scheduler.now;
+            end.progress = 0;
+            end.waiting_since = 0;
+        }
+
+        std::thread other([&] { run_end(ends[1], cycles); });
+        run_end(ends[0], cycles);
+        other.join();
+    }
+
+    // bytes that went across, in either direction
+    u64 bytes_exchanged() const { return exchanged; }
+
+private:
+    static constexpr u64 finished = ~u64(0);
+
+    struct End : SerialLink {
+        LinkCable& cable;
+        GameBoy& gb;
+        int side;
+        u64 start = 0;
+        std::atomic<u64> progress{0}; // cycles since start, published as it runs
+        bool cut = false; // only touched on its own thread
+
+        // under mutex
+        bool waiting = false;
+        u64 waiting_since = 0;
+        u8 out = 0xff;
+        bool delivered = false;
+        u64 due = 0; // when the delivered byte lands
+        u8 in = 0xff;
+
+        End(LinkCable& cable, GameBoy& gb, int side) : cable(cable), gb(gb), side(side) {}
+
+        u64 now() const { return gb.scheduler.now - start; }
+
+        void external(bool wait, u8 value) override {
+            std::lock_guard<std::mutex> lock(cable.mutex);
+            if (wait && !waiting) {
+                waiting_since = now();
+                cut = true;
+            }
+            waiting = wait;
+            out = value;
+        }
+
+        // a peer not waiting yet may still start to before this cycle, so it has to get here first
+        u8 exchange(u8 value) override {
+            End& peer = cable.ends[side ^ 1];
+            u64 at = now();
+            progress.store(at, std::memory_order_release); // lets a peer waiting on the clock come up to here
+
+            for (;;) {
+                u64 seen = peer.progress.load(std::memory_order_acquire);
+                {
+                    std::lock_guard<std::mutex> lock(cable.mutex);
+                    if (peer.waiting && peer.waiting_since <= at && !peer.delivered) {
+                        peer.waiting = false;
+                        peer.delivered = true;
+                        peer.due = at;
+                        peer.in = value;
+                        cable.exchanged += 2;
+                        return peer.out;
+                    }
+                    if (seen >= at)
+                        return 0xff;
+                }
+                // nothing changes before its next slice ends, and the mutex stays free for it meanwhile
+                while (peer.progress.load(std::memory_order_acquire) == seen)
+                    std::this_thread::yield();
+            }
+        }
+    };
+
+    End ends[2];
+    u64 quantum;
+    std::mutex mutex;
+    u64 exchanged = 0;
+
+    // an end may get a quantum ahead of the other. one waiting on the external clock never gets past
+    // the other, or the byte clocked in would land whenever the host got to it instead of the cycle
+    // it was sent. a bit time past is fine while both wait, neither can send in less than a byte.
+    // one stuck in exchange() publishes the cycle it stopped at, so the two never wait on each other
+    void run_end(End& end, u64 cycles) {
+        End& peer = ends[end.side ^ 1];
+        u64 slice = quantum / 2;
+        u64 bit_slice = std::min(slice, Serial::transfer_cycles / 8);
+
+        while (end.now() < cycles) {
+            u64 until = std::min(cycles, (end.now() + slice) / bit_slice * bit_slice);
+            bool waiting;
+            // before the lock: a peer seen waiting under it was still waiting when it got this far
+            u64 seen = peer.progress.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                receive(end);
+                if (end.delivered)
+                    until = std::min(until, end.due);
+                waiting = end.waiting;
+                if (waiting && seen != finished)
+                    until = std::min(until, peer.waiting ? seen + bit_slice : seen);
+            }
+
+            if (waiting && until <= end.now()) {
+                while (peer.progress.load(std::memory_order_acquire) == seen)
+                    std::this_thread::yield();
+                continue;
+            }
+            while (!waiting && end.now() > quantum
+                   && end.now() - quantum > peer.progress.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            // in bit sized pieces, so a transfer started on the external clock ends the slice soon. on
+            // a grid, so where it ends does not depend on when the slice began
+            for (end.cut = false; end.now() < until && !end.cut;) {
+                end.gb.run(std::min(bit_slice - end.now() % bit_slice, until - end.now()));
+                end.progress.store(end.now(), std::memory_order_release);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        receive(end);
+        end.progress.store(finished, std::memory_order_release);
+    }
+
+    // under mutex
+    static void receive(End& end) {
+        if (end.delivered && end.now() >= end.due) {
+            end.delivered = false;
+            end.gb.serial.receive(end.in);
+        }
+    }
+};
@@ -1,30 +1,202 @@
 #pragma once
+#include <array>
 #include <memory>
 #include <utility>
+#include "tile.hpp"
+
+enum class Interrupt : u8 {
+    VBlank = 1 << 0,
+    Lcd = 1 << 1,
+    Timer = 1 << 2,
+    Serial = 1 << 3,
+    Joypad = 1 << 4,
+};
+
+// owner of some registers in 0xff00 - 0xff7f
+class IoDevice {
+public:
+    virtual ~IoDevice() = default;
+    virtual u8 io_read(u16 address) = 0;
+    virtual void io_write(u16 address, u8 value) = 0;
+};
 
 class MMU {
 public:
-    explicit MMU(Cartrigde& cart) : cart(cart) {temp = std::vector<u8>(0xffff, 0);}
+    explicit MMU(Cartrigde& cart) : cart(cart) {
+        for (int page = 0x80; page < 0xa0; page++) // tile data writes go slow, to keep tiles up to date
+            read_pages[page] = &vram[(page - 0x80) << 8];
+        for (int page = 0x98; page < 0xa0; page++)
+            write_pages[page] = &vram[(page - 0x80) << 8];
+        for (int page = 0xc0; page < 0xfe; page++) // 0xe000 on is echo of 0xc000
+            read_pages[page] = write_pages[page] = &wram[((page - 0xc0) << 8) & 0x1fff];
+
+        map_cartridge();
+    }
 
     u8 read(u16 address) const {
+        if (const u8* page = read_pages[address >> 8])
+            return page[address & 0xff];
+
+        return read_slow(address);
+    }
+
+    void write(u16 address, u8 value) {
+        if (u8* page = write_pages[address >> 8]) {
+            page[address & 0xff] = value;
+            page_versions[version_page(address)]++;
+        } else {
+            write_slow(address, value);
+        }
+    }
+
+    // bumped on every write to a 256 bytes page, lets decoded code detect it went stale
+    u32 page_version(u16 address) const { return page_versions[version_page(address)]; }
+
+    // bank mapped at address, rom or cartridge ram
+    u16 bank(u16 address) const {
+        return address < 0x8000 || (address >= 0xa000 && address < 0xc000) ? cart.bank(address) : 0;
+    }
+
+    size_t rom_banks() const { return cart.rom_bank_count(); }
+
+    void attach(IoDevice& device, u16 first, u16 last) {
+        for (u16 address = first; address <= last; address++)
+            io_devices[address - 0xff00] = &device;
+    }
+
+    void request_interrupt(Interrupt i) { io[0x0f] |= static_cast<u8>(i); }
+
+    // requested and enabled, lowest bit first in priority
+    u8 pending_interrupts() const { return io[0x0f] & ie & 0x1f; }
+
+    void acknowledge_interrupt(u8 bit) { io[0x0f] &= ~bit; }
+
+    // for the ppu, which reads them directly rather than through read()
+    const std::array<u8, 0x2000>& video_ram() const { return vram; }
+    const std::array<u8, 0xa0>& object_ram() const { return oam; }
+    TileCache& tile_cache() { return tiles; }
+
+    // just the memory, the cartridge and the devices keep their own state
+    struct State {
+        std::array<u8, 0x2000> vram;
+        std::array<u8, 0x2000> wram;
+        std::array<u8, 0xa0> oam;
+        std::array<u8, 0x80> io;
+        std::array<u8, 0x7f> hram;
+        u8 ie;
+    };
+
+    void save(State& state) const {
+        state.vram = vram;
+        state.wram = wram;
+        state.oam = oam;
+        state.io = io;
+        state.hram = hram;
+        state.ie = ie;
+    }
+
+    // load the cartridge first, its banks get mapped again here. everything outside rom may have
+    // changed under decoded code
+    void load(const State& state) {
+        vram = state.vram;
+        wram = state.wram;
+        oam = state.oam;
+        io = state.io;
+        hram = state.hram;
+        ie = state.ie;
+
+        for (int page = 0x80; page < 0x100; page++)
+            page_versions[page]++;
+        tiles.invalidate_all();
+        map_cartridge();
+    }
+
+private:
+    Cartrigde& cart;
+
+    // one entry per 256 bytes page, nullptr goes through read_slow / write_slow
+    std::array<const u8*, 256> read_pages{};
+    std::array<u8*, 256> write_pages{};
+    std::array<u32, 256> page_versions{};
+
+    std::array<u8, 0x2000> vram{};
+    TileCache tiles{vram};
+    std::array<u8, 0x2000> wram{};
+    std::array<u8, 0xa0> oam{};
+    std::array<u8, 0x80> io{};
+    std::array<IoDevice*, 0x80> io_devices{};
+    std::array<u8, 0x7f> hram{};
+    u8 ie = 0;
+
+    // echo ram shares its versions with the wram it mirrors
+    static u8 version_page(u16 address) {
+        u8 page = address >> 8;
+        return page >= 0xe0 && page < 0xfe ? page - 0x20 : page;
+    }
+
+    // rom is read only, writes go to the cartridge and may swap what is mapped. a bank switch is
+    // just these pointers changing
+    void map_cartridge() {
+        for (int page = 0; page < 0x80; page++)
+            read_pages[page] = cart.rom_page(page);
+        for (int page = 0xa0; page < 0xc0; page++) {
+            read_pages[page] = cart.ram_page(page);
+            write_pages[page] = cart.ram_write_page(page);
+        }
+    }
+
+    u8 read_slow(u16 address) const {
         switch (address) {
-            case 0 ... 0x7fff:
-                return cart.read(address);
+            case 0xa000 ... 0xbfff:
+                return cart.read_ram(address);
+            case 0xfe00 ... 0xfe9f:
+                return oam[address - 0xfe00];
+            case 0xff00 ... 0xff7f:
+                if (IoDevice* device = io_devices[address - 0xff00])
+                    return device->io_read(address);
+                return address == 0xff0f ? io[0x0f] | 0xe0 : io[address - 0xff00];
+            case 0xff80 ... 0xfffe:
+                return hram[address - 0xff80];
+            case 0xffff:
+                return ie;
             default:
-                return temp[address]; // TODO
+                return 0xff;
         }
     }
 
-    void write(u16 address, u8 value) {
-        switch (address) { // TODO implement the "do nothing" and so from invalid regions
+    void write_slow(u16 address, u8 value) {
+        if (address >= 0x8000) // rom writes only reach the bank controller
+            page_versions[version_page(address)]++;
+
+        switch (address) {
             case 0 ... 0x7fff:
                 cart.write(address, value);
+                map_cartridge();
+                break;
+            case 0x8000 ... 0x97ff:
+                vram[address - 0x8000] = value;
+                tiles.invalidate(address - 0x8000);
+                break;
+            case 0xa000 ... 0xbfff:
+                cart.write_ram(address, value);
+                break;
+            case 0xfe00 ... 0xfe9f:
+                oam[address - 0xfe00] = value;
+                break;
+            case 0xff00 ... 0xff7f:
+                if (IoDevice* device = io_devices[address - 0xff00])
+                    device->io_write(address, value);
+                else
+                    io[address - 0xff00] = value;
+                break;
+            case 0xff80 ... 0xfffe:
+                hram[address - 0xff80] = value;
+                break;
+            case 0xffff:
+                ie = value;
+                break;
             default:
-                temp[address] = value; // TODO
+                break;
         }
     }
-
-private:
-    Cartrigde& cart;
-    std::vector<u8> temp; // TODO remove
 };
@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of workers, each with its own task queue. a worker takes its newest task first and
+// steals the oldest one of another worker when it runs dry, so tasks that submit follow-ups keep
+// their instance warm in one core's cache
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // tasks submitted together to be waited on together, see wait(Group&)
+    class Group {
+    public:
+        Group() = default;
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> left{0}; // goes down under the pool's mutex
+    };
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        threads = std::max<size_t>(1, threads);
+        for (size_t i = 0; i < threads; i++)
+            queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // from a task it goes to the queue of the worker running it, from outside round robin
+    void submit(Task task) {
+        size_t i = owner == this ? current : next_queue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex); // counted before anyone can take it
+            pending++;
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[i]->mutex);
+            queues[i]->tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    void submit(Group& group, Task task) {
+        group.left++;
+        submit([this, &group, task = std::move(task)] {
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--group.left == 0)
+                idle.notify_all();
+        });
+    }
+
+    // until every task submitted, follow-ups included, has finished. from outside the pool only, a
+    // task would be waiting on itself
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+    // until the group's tasks have finished. a task waiting here runs queued ones meanwhile, its own
+    // group's or not: blocking would hold up a worker, and with every worker waiting on a group
+    // nobody would be left to run them
+    void wait(Group& group) {
+        if (owner != this) {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [&group] { return group.left == 0; });
+            return;
+        }
+
+        while (group.left > 0) {
+            Task task;
+            if (take(current, task))
+                run(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex mutex; // guards pending and stopping, and queued going up
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t pending = 0; // queued or running
+    std::atomic<size_t> queued{0}; // may count a task for a moment before it is pushed
+    bool stopping = false;
+    std::atomic<size_t> next_queue{0};
+
+    // the worker on this thread, if it is one
+    static inline thread_local const ThreadPool* owner = nullptr;
+    static inline thread_local size_t current = 0;
+
+    bool take(size_t self, Task& task) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+
+        for (size_t n = 1; n < queues.size(); n++) {
+            Queue& victim = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(Task& task) {
+        task();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            idle.notify_all();
+    }
+
+    void work(size_t self) {
+        owner = this;
+        current = self;
+        while (true) {
+            Task task;
+            if (take(self, task)) {
+                run(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping)
+                return;
+        }
+    }
+};
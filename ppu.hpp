@@ -0,0 +1,535 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include "mmu.hpp"
+#include "scheduler.hpp"
+#include "tile.hpp"
+
+// lcd timing: modes, ly and the interrupts they raise, one Event::LcdMode per mode change. pixels
+// come from one of two tiers, picked when it is built
+class PPU : public IoDevice {
+public:
+    enum Mode : u8 { HBlank = 0, VBlank = 1, OamScan = 2, Transfer = 3 };
+
+    enum class Accuracy {
+        Scanline, // each line drawn whole when its transfer ends, transfers always take 172 dots
+        Fifo, // the fetcher and pixel fifo stepped dot by dot, caught up when a register changes mid
+              // line. transfers get longer with scroll, the window and sprites like on hardware
+    };
+
+    static constexpr int width = 160;
+    static constexpr int height = 144;
+
+
+    PPU(MMU& mmu, Scheduler& scheduler, Accuracy accuracy = Accuracy::Scanline)
+        : mmu(mmu), scheduler(scheduler), accuracy(accuracy) {
+        mmu.attach(*this, 0xff40, 0xff45);
+        mmu.attach(*this, 0xff47, 0xff4b);
+        enter(OamScan, scheduler.now);
+    }
+
+    u8 io_read(u16 address) override {
+        if (address == 0xff41 || address == 0xff44)
+            resume(); // a program polling these may wait on any line
+
+        switch (address) {
+            case 0xff40: return lcdc;
+            case 0xff41: return 0x80 | stat | (ly == lyc ? 4 : 0) | (enabled() ? mode : 0);
+            case 0xff42: return scy;
+            case 0xff43: return scx;
+            case 0xff44: return ly;
+            case 0xff45: return lyc;
+            case 0xff47: return bgp;
+            case 0xff48: return obp0;
+            case 0xff49: return obp1;
+            case 0xff4a: return wy;
+            default: return wx;
+        }
+    }
+
+    void io_write(u16 address, u8 value) override {
+        if (accuracy == Accuracy::Fifo && mode == Transfer && enabled())
+            catch_up(scheduler.now); // the pixels so far saw the old value
+        if (address == 0xff40 || address == 0xff41 || address == 0xff45)
+            resume();
+
+        switch (address) {
+            case 0xff40: {
+                bool was_enabled = enabled();
+                lcdc = value;
+                if (was_enabled && !enabled()) {
+                    scheduler.cancel(Event::LcdMode);
+                    ly = 0;
+                    mode = HBlank;
+                } else if (!was_enabled && enabled()) {
+                    ly = 0;
+                    enter(OamScan, scheduler.now);
+                }
+                break;
+            }
+            case 0xff41: stat = value & 0x78; break;
+            case 0xff42: scy = value; break;
+            case 0xff43: scx = value; break;
+            case 0xff44: break; // read only
+            case 0xff45: lyc = value; compare_ly(); break;
+            case 0xff47: bgp = value; break;
+            case 0xff48: obp0 = value; break;
+            case 0xff49: obp1 = value; break;
+            case 0xff4a: wy = value; break;
+            default: wx = value; break;
+        }
+    }
+
+    // Event::LcdMode
+    void mode_change() {
+        if (coarse) { // carry on from just before the end of the stretch
+            coarse = false;
+            bool to_vblank = mode_end == frame_start + 144 * 456;
+            ly = to_vblank ? 143 : 153;
+            mode = to_vblank ? HBlank : VBlank;
+        }
+
+        switch (mode) {
+            case OamScan:
+                enter(Transfer, mode_end);
+                break;
+            case Transfer:
+                if (accuracy == Accuracy::Fifo) {
+                    catch_up(mode_end);
+                    if (!fifo.done) { // at least a dot per pixel left
+                        mode_end += width - fifo.x;
+                        scheduler.schedule(Event::LcdMode, mode_end);
+                        break;
+                    }
+                    if (fifo.window)
+                        window_line++;
+                    enter(HBlank, line_start + 80 + fifo.dot);
+                    break;
+                }
+                if (drawing())
+                    render_line();
+                enter(HBlank, mode_end);
+                break;
+            case HBlank:
+                next_line();
+                enter(ly == 144 ? VBlank : OamScan, mode_end);
+                break;
+            case VBlank:
+                next_line();
+                enter(ly == 0 ? OamScan : VBlank, mode_end);
+                break;
+        }
+    }
+
+    u64 frame_count() const { return frames; }
+
+    // off for frames nobody is going to see, the timing stays the same
+    void set_render(bool on) {
+        resume();
+        render = on;
+    }
+
+    // draw one frame in interval, 1 draws all of them and 0 none
+    void set_frame_skip(u32 interval) { skip_interval = interval; }
+
+    // the next frame that starts gets drawn whatever the frame skip and set_render say
+    void request_frame() { frame_requested = true; }
+
+    // frames drawn whole so far
+    u64 frames_drawn() const { return drawn; }
+
+    // shades 0 (white) - 3 (black), palettes applied, row by row
+    const std::array<u8, width * height>& framebuffer() const { return screen; }
+
+private:
+    // a fifo tier line in progress
+    struct Fifo {
+        u16 dot; // since the transfer started
+        u8 x; // next pixel out
+        u8 discard; // scx & 7 pixels thrown away first
+        u8 stall; // dots left of the first fetch or a sprite fetch
+        u8 step; // of the fetcher, a dot each, pushing at 6 once the fifo is empty
+        u8 fetch_x; // tile column
+        u8 tile;
+        bool window;
+        bool done;
+        u8 row[8]; // fetched, waiting to be pushed
+        u8 bg[8];
+        u8 bg_next; // 8 when empty
+        u8 obj_color[8]; // indexed by screen x & 7, 0 when no sprite
+        u8 obj_attr[8];
+        u8 sprites[10];
+        u8 sprite_count;
+        u8 next_sprite;
+    };
+
+public:
+    struct State {
+        u64 mode_end;
+        u64 line_start;
+        u64 frame_start;
+        u64 frames;
+        Mode mode;
+        u8 lcdc, stat, scy, scx, ly, lyc, bgp, obp0, obp1, wy, wx;
+        u8 window_line;
+        bool coarse;
+        bool draw_frame;
+        bool forced_frame;
+        Fifo fifo;
+    };
+
+    void save(State& state) const {
+        state = {mode_end, line_start, frame_start, frames, mode, lcdc, stat, scy, scx, ly, lyc, bgp, obp0, obp1,
+                 wy, wx, window_line, coarse, draw_frame, forced_frame, fifo};
+    }
+
+    void load(const State& state) {
+        mode_end = state.mode_end;
+        line_start = state.line_start;
+        frame_start = state.frame_start;
+        frames = state.frames;
+        mode = state.mode;
+        lcdc = state.lcdc;
+        stat = state.stat;
+        scy = state.scy;
+        scx = state.scx;
+        ly = state.ly;
+        lyc = state.lyc;
+        bgp = state.bgp;
+        obp0 = state.obp0;
+        obp1 = state.obp1;
+        wy = state.wy;
+        wx = state.wx;
+        window_line = state.window_line;
+        coarse = state.coarse;
+        draw_frame = state.draw_frame;
+        forced_frame = state.forced_frame;
+        fifo = state.fifo;
+    }
+
+private:
+    MMU& mmu;
+    Scheduler& scheduler;
+    Accuracy accuracy;
+    Mode mode = OamScan;
+    u64 mode_end = 0; // counted from here rather than from when the event got handled
+    u64 line_start = 0;
+    u64 frame_start = 0;
+    u64 frames = 0;
+    u8 lcdc = 0x91;
+    u8 stat = 0;
+    u8 scy = 0;
+    u8 scx = 0;
+    u8 ly = 0;
+    u8 lyc = 0;
+    u8 bgp = 0xfc;
+    u8 obp0 = 0xff;
+    u8 obp1 = 0xff;
+    u8 wy = 0;
+    u8 wx = 0;
+    u8 window_line = 0; // lines of the window drawn this frame
+    std::array<u8, width * height> screen{};
+    Fifo fifo{};
+
+    bool render = true;
+    bool draw_frame = true; // picked by the frame skip when the frame starts
+    bool forced_frame = false; // drawn even with render off
+    bool frame_requested = false;
+    u32 skip_interval = 1;
+    u64 drawn = 0;
+
+    // stretches of lines nothing looks at go by with one event, up to vblank and then up to the
+    // next frame. ly and the mode catch up when read, or when a register the timing depends on
+    // is written
+    bool coarse = false;
+
+    bool enabled() const { return lcdc & 0x80; }
+    bool drawing() const { return draw_frame && (render || forced_frame); }
+
+    void next_line() {
+        ly = ly == 153 ? 0 : ly + 1;
+        compare_ly();
+    }
+
+    void compare_ly() {
+        if (ly == lyc && (stat & 0x40))
+            mmu.request_interrupt(Interrupt::Lcd);
+    }
+
+    void enter(Mode m, u64 start) {
+        static constexpr u16 lengths[] = {204, 456, 80, 172};
+        static constexpr u8 stat_sources[] = {0x08, 0x10, 0x20, 0};
+
+        if (m != mode) {
+            if (m == VBlank) {
+                frames++;
+                drawn += drawing();
+                window_line = 0;
+                mmu.request_interrupt(Interrupt::VBlank);
+            }
+            if (stat & stat_sources[m])
+                mmu.request_interrupt(Interrupt::Lcd);
+        }
+
+        mode = m;
+        if (m == OamScan)
+            line_start = start;
+        if (m == OamScan && ly == 0) {
+            frame_start = start;
+            draw_frame = frame_requested || (skip_interval && frames % skip_interval == 0);
+            forced_frame = frame_requested;
+            frame_requested = false;
+        }
+        if (m == Transfer && accuracy == Accuracy::Fifo)
+            start_fifo();
+        // hblank fills the line up to 456 dots whatever the transfer took
+        mode_end = m == HBlank ? line_start + 456 : start + lengths[m];
+        scheduler.schedule(Event::LcdMode, mode_end);
+
+        if ((m == OamScan && ly == 0) || (m == VBlank && ly == 144))
+            coast();
+    }
+
+    // the fifo tier only coasts through vblank, its transfers take varying time
+    void coast() {
+        bool visible = ly < 144;
+        if ((stat & 0x78) || (visible && (drawing() || accuracy == Accuracy::Fifo)))
+            return;
+
+        coarse = true;
+        mode_end = frame_start + (visible ? 144 : 154) * 456;
+        scheduler.schedule(Event::LcdMode, mode_end);
+    }
+
+    // back to an event per mode change from wherever the clock is now
+    void resume() {
+        if (!coarse)
+            return;
+
+        static constexpr u16 ends[] = {456, 456, 80, 252}; // into the line
+        u64 offset = std::min(scheduler.now, mode_end - 1) - frame_start;
+        u64 dot = offset % 456;
+        ly = offset / 456;
+        line_start = frame_start + ly * 456;
+        mode = ly >= 144 ? VBlank : dot < 80 ? OamScan : dot < 252 ? Transfer : HBlank;
+
+        coarse = false;
+        mode_end = line_start + ends[mode];
+        scheduler.schedule(Event::LcdMode, mode_end);
+    }
+
+    u16 bg_tile(u8 tile) const { return lcdc & 0x10 ? tile : 256 + static_cast<s8>(tile); }
+
+    // ten sprites a line at most, picked in oam order, then sorted by x. the lowest x wins an
+    // overlap, then the lowest oam index
+    int select_sprites(u8* found) const {
+        const auto& oam = mmu.object_ram();
+        int h = lcdc & 0x04 ? 16 : 8;
+
+        int count = 0;
+        for (int i = 0; i < 40 && count < 10; i++) {
+            int row = ly - (oam[i * 4] - 16);
+            if (row >= 0 && row < h) {
+                int j = count++;
+                for (; j > 0 && oam[found[j - 1] * 4 + 1] > oam[i * 4 + 1]; j--)
+                    found[j] = found[j - 1];
+                found[j] = i;
+            }
+        }
+        return count;
+    }
+
+    // eight color numbers of the line of a sprite, flips applied
+    void sprite_row(const u8* sprite, u8* out) const {
+        int h = lcdc & 0x04 ? 16 : 8;
+        u8 attr = sprite[3];
+        int row = ly - (sprite[0] - 16);
+        if (attr & 0x40)
+            row = h - 1 - row;
+
+        u8 tile = (h == 16 ? sprite[2] & 0xfe : sprite[2]) + row / 8;
+        const u8* pixels = mmu.tile_cache().row(tile, row & 7);
+        for (int i = 0; i < 8; i++)
+            out[i] = pixels[attr & 0x20 ? 7 - i : i];
+    }
+
+    // color numbers of count tiles from tile_x on in the map row holding line y
+    void fetch_tiles(u8* out, u16 map, u8 tile_x, u8 y, int count) const {
+        TileCache& cache = mmu.tile_cache();
+        const u8* row = &mmu.video_ram()[map + (y / 8) * 32];
+        for (int i = 0; i < count; i++) {
+            u8 tile = row[(tile_x + i) & 31];
+            std::memcpy(out + i * 8, cache.row(bg_tile(tile), y & 7), 8);
+        }
+    }
+
+    void render_line() {
+        std::array<u8, width> bg{}; // color numbers before the palette, sprites check them for 0
+        std::array<u8, width + 16> tiles;
+
+        if (lcdc & 0x01) {
+            u8 y = ly + scy;
+            fetch_tiles(tiles.data(), lcdc & 0x08 ? 0x1c00 : 0x1800, scx / 8, y, 21);
+            std::memcpy(bg.data(), &tiles[scx & 7], width);
+
+            if ((lcdc & 0x20) && ly >= wy && wx < 167) {
+                int start = wx - 7;
+                fetch_tiles(tiles.data(), lcdc & 0x40 ? 0x1c00 : 0x1800, 0, window_line++, 21);
+                for (int x = std::max(0, start); x < width; x++)
+                    bg[x] = tiles[x - start];
+            }
+        }
+
+        u8 shades[4] = {};
+        if (lcdc & 0x01)
+            for (int c = 0; c < 4; c++)
+                shades[c] = (bgp >> (c * 2)) & 3;
+
+        u8* out = &screen[ly * width];
+        for (int x = 0; x < width; x++)
+            out[x] = shades[bg[x]];
+
+        if (lcdc & 0x02)
+            render_sprites(bg, out);
+    }
+
+    // drawn from the lowest priority up, the last one drawn shows
+    void render_sprites(const std::array<u8, width>& bg, u8* out) const {
+        const auto& oam = mmu.object_ram();
+        u8 found[10];
+        int count = select_sprites(found);
+
+        std::array<u8, width> color{}; // 0 where no sprite shows
+        std::array<u8, width> attributes;
+        for (int n = count - 1; n >= 0; n--) {
+            const u8* sprite = &oam[found[n] * 4];
+            u8 pixels[8];
+            sprite_row(sprite, pixels);
+            for (int i = 0; i < 8; i++) {
+                int x = sprite[1] - 8 + i;
+                if (x >= 0 && x < width && pixels[i]) {
+                    color[x] = pixels[i];
+                    attributes[x] = sprite[3];
+                }
+            }
+        }
+
+        for (int x = 0; x < width; x++) {
+            if (!color[x] || ((attributes[x] & 0x80) && bg[x]))
+                continue;
+            u8 palette = attributes[x] & 0x10 ? obp1 : obp0;
+            out[x] = (palette >> (color[x] * 2)) & 3;
+        }
+    }
+
+    void start_fifo() {
+        fifo = {};
+        fifo.discard = scx & 7;
+        fifo.stall = 6; // the first tile gets fetched twice
+        fifo.bg_next = 8;
+        fifo.sprite_count = select_sprites(fifo.sprites);
+    }
+
+    // runs the dots of the transfer before time
+    void catch_up(u64 time) {
+        u64 start = line_start + 80;
+        while (!fifo.done && start + fifo.dot < time) {
+            fifo.dot++;
+            tick();
+        }
+    }
+
+    void tick() {
+        Fifo& f = fifo;
+        if (f.stall) {
+            f.stall--;
+            return;
+        }
+
+        if (!f.window && (lcdc & 0x21) == 0x21 && ly >= wy && f.x + 7 >= wx) { // restart on the window
+            f.window = true;
+            f.fetch_x = 0;
+            f.step = 0;
+            f.bg_next = 8;
+            f.discard = wx < 7 ? 7 - wx : 0; // the window starts left of the screen
+        }
+
+        // sprites starting here pause everything while they are fetched
+        if (f.next_sprite < f.sprite_count && !f.discard) {
+            const u8* sprite = &mmu.object_ram()[f.sprites[f.next_sprite] * 4];
+            if ((lcdc & 0x02) && sprite[1] <= f.x + 8) {
+                merge_sprite(sprite);
+                f.next_sprite++;
+                f.stall = 5;
+                return;
+            }
+        }
+
+        fetch();
+
+        if (f.bg_next == 8)
+            return;
+        u8 color = f.bg[f.bg_next++];
+        if (f.discard) {
+            f.discard--;
+            return;
+        }
+
+        u8 slot = f.x & 7;
+        u8 shade = lcdc & 0x01 ? (bgp >> (color * 2)) & 3 : 0;
+        if (f.obj_color[slot] && (lcdc & 0x02) && !((f.obj_attr[slot] & 0x80) && color && (lcdc & 0x01))) {
+            u8 palette = f.obj_attr[slot] & 0x10 ? obp1 : obp0;
+            shade = (palette >> (f.obj_color[slot] * 2)) & 3;
+        }
+        f.obj_color[slot] = 0;
+
+        if (drawing())
+            screen[ly * width + f.x] = shade;
+        if (++f.x == width)
+            f.done = true;
+    }
+
+    void fetch() {
+        Fifo& f = fifo;
+        switch (f.step) {
+            case 0: {
+                u16 map = (f.window ? lcdc & 0x40 : lcdc & 0x08) ? 0x1c00 : 0x1800;
+                u8 y = f.window ? window_line : ly + scy;
+                u8 column = f.window ? f.fetch_x : (scx / 8 + f.fetch_x) & 31;
+                f.tile = mmu.video_ram()[map + (y / 8) * 32 + column];
+                f.step++;
+                break;
+            }
+            case 4: {
+                u8 y = f.window ? window_line : ly + scy;
+                std::memcpy(f.row, mmu.tile_cache().row(bg_tile(f.tile), y & 7), 8);
+                f.step++;
+                break;
+            }
+            case 6:
+                if (f.bg_next == 8) {
+                    std::memcpy(f.bg, f.row, 8);
+                    f.bg_next = 0;
+                    f.fetch_x++;
+                    f.step = 0;
+                }
+                break;
+            default:
+                f.step++;
+                break;
+        }
+    }
+
+    // pixels already in the fifo came from sprites with priority, only free slots take new ones
+    void merge_sprite(const u8* sprite) {
+        u8 pixels[8];
+        sprite_row(sprite, pixels);
+        for (int i = 0; i < 8; i++) {
+            int x = sprite[1] - 8 + i;
+            if (x < fifo.x || x >= width || !pixels[i] || fifo.obj_color[x & 7])
+                continue;
+            fifo.obj_color[x & 7] = pixels[i];
+            fifo.obj_attr[x & 7] = sprite[3];
+        }
+    }
+};
@@ -0,0 +1,34 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "gbemuz.hpp"
+
+// gbemuz-profile <rom> [seconds] [folded]
+// runs the rom headless for seconds of emulated time (10 by default), prints where the cycles went
+// and writes the call stacks to folded (gbemuz.folded by default) for flamegraph.pl or speedscope.
+// only built with GBEMUZ_PROFILE
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <rom> [seconds] [folded]" << std::endl;
+        return 1;
+    }
+
+    GameBoy gb(RomImage::open(argv[1]));
+    gb.ppu.set_render(false);
+    gb.run(static_cast<u64>((argc > 2 ? std::stod(argv[2]) : 10) * CLOCK_FREQUENCY));
+
+    const Profiler& profiler = gb.cpu.profiler();
+    profiler.report(std::cout);
+
+    std::string path = argc > 3 ? argv[3] : "gbemuz.folded";
+    std::ofstream folded(path);
+    if (!folded) {
+        std::cerr << "cannot write " << path << std::endl;
+        return 1;
+    }
+    profiler.folded(folded);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+
+// where emulated time goes: instructions and cycles per opcode, per pc and bank and per memory region
+// the code ran from, and cycles per call stack for flame graphs. one per cpu, so nothing is shared.
+// everything is allocated up front and indexed directly, counting an instruction never allocates,
+// hashes or moves anything. only built in with GBEMUZ_PROFILE, see CPU::profiler
+class Profiler {
+public:
+    struct Counter {
+        u64 count = 0;
+        u64 cycles = 0;
+
+        void add(size_t c) {
+            count++;
+            cycles += c;
+        }
+    };
+
+    enum class Region : u8 { Rom0, RomX, Vram, Sram, Wram, Echo, Oam, Unusable, Io, Hram, Ie, Count };
+
+    explicit Profiler(size_t rom_banks)
+        : banks(std::max<size_t>(rom_banks, 2)), rom(new Counter[banks * 0x4000]), ram(new Counter[0x8000]),
+          nodes(new Node[max_nodes]) {
+        reset();
+    }
+
+    // pc is where the instruction starts, bank what was mapped there
+    void instruction(u8 op, bool prefixed, u16 pc, u16 bank, size_t cycles) {
+        (prefixed ? prefixed_ops : regular_ops)[op].add(cycles);
+        regions[static_cast<size_t>(region_of(pc))].add(cycles);
+        (pc < 0x8000 ? rom[(bank % banks) << 14 | (pc & 0x3fff)] : ram[pc - 0x8000]).add(cycles);
+        nodes[stack[depth]].cycles += cycles;
+    }
+
+    // a call or rst went to address
+    void call(u16 address, u16 bank) { enter(frame(address, bank)); }
+
+    void ret() {
+        if (lost)
+            lost--;
+        else if (depth)
+            depth--;
+    }
+
+    // the dispatch pushing pc and jumping to vector
+    void interrupt(u16 vector, size_t cycles) {
+        enter(interrupt_frame | vector);
+        nodes[stack[depth]].cycles += cycles;
+    }
+
+    // back at the bottom, for when the stack being tracked no longer exists
+    void unwind() {
+        stack[0] = 0;
+        depth = 0;
+        lost = 0;
+    }
+
+    // halted, or skipped over by fast_forward
+    void idle(size_t cycles) {
+        idle_cycles += cycles;
+        nodes[child(stack[depth], idle_frame)].cycles += cycles;
+    }
+
+    void reset() {
+        regular_ops = {};
+        prefixed_ops = {};
+        regions = {};
+        std::fill_n(rom.get(), banks * 0x4000, Counter{});
+        std::fill_n(ram.get(), 0x8000, Counter{});
+        nodes[0] = {0, 0, none, none, 0};
+        node_count = 1;
+        unwind();
+        idle_cycles = 0;
+    }
+
+    const std::array<Counter, 256>& regular() const { return regular_ops; }
+    const std::array<Counter, 256>& prefixed() const { return prefixed_ops; }
+    const Counter& region(Region r) const { return regions[static_cast<size_t>(r)]; }
+    u64 idle() const { return idle_cycles; }
+
+    // the top entries of each table by cycles
+    void report(std::ostream& out, size_t top = 20) const {
+        u64 total = 0;
+        for (const Counter& c : regions)
+            total += c.cycles;
+
+        out << "cycles: " << total << " running, " << idle_cycles << " idle" << std::endl;
+
+        static constexpr const char* region_names[] = {"rom0", "romx", "vram", "sram", "wram", "echo",
+                                                       "oam", "unusable", "io", "hram", "ie"};
+        std::vector<Entry> entries;
+        for (size_t i = 0; i < regions.size(); i++)
+            entries.push_back({region_names[i], regions[i]});
+        table(out, "regions", entries, total, top);
+
+        entries.clear();
+        for (int op = 0; op < 256; op++)
+            entries.push_back({hex(op, 2), regular_ops[op]});
+        table(out, "opcodes", entries, total, top);
+
+        entries.clear();
+        for (int op = 0; op < 256; op++)
+            entries.push_back({"cb " + hex(op, 2), prefixed_ops[op]});
+        table(out, "cb opcodes", entries, total, top);
+
+        entries.clear();
+        for (size_t i = 0; i < banks * 0x4000; i++)
+            if (rom[i].count)
+                entries.push_back({name(rom_frame(i)), rom[i]});
+        for (size_t i = 0; i < 0x8000; i++)
+            if (ram[i].count)
+                entries.push_back({name(frame(0x8000 + i, 0)), ram[i]});
+        table(out, "addresses", entries, total, top);
+    }
+
+    // one line per call stack, frames from the outermost separated by ; then the cycles spent in
+    // it, what flamegraph.pl and speedscope read
+    void folded(std::ostream& out) const {
+        std::vector<u32> stack;
+        for (u32 i = 0; i < node_count; i++) {
+            if (!nodes[i].cycles)
+                continue;
+
+            stack.clear();
+            for (u32 n = i; n; n = nodes[n].parent)
+                stack.push_back(nodes[n].frame);
+
+            out << "start";
+            for (auto frame = stack.rbegin(); frame != stack.rend(); ++frame)
+                out << ';' << name(*frame);
+            out << ' ' << nodes[i].cycles << '\n';
+        }
+    }
+
+private:
+    static constexpr size_t max_depth = 64;
+    static constexpr u32 max_nodes = 1 << 16;
+    static constexpr u32 none = ~u32(0);
+    static constexpr u32 idle_frame = ~u32(0);
+    static constexpr u32 interrupt_frame = 1u << 31; // | vector
+
+    // the call tree, 0 being the root. children are found through their siblings, a call site
+    // rarely has more than a few
+    struct Node {
+        u32 parent;
+        u32 frame; // bank << 16 | address, or one of the special frames
+        u32 first_child;
+        u32 next_sibling;
+        u64 cycles;
+    };
+
+    struct Entry {
+        std::string name;
+        Counter counter;
+    };
+
+    std::array<Counter, 256> regular_ops;
+    std::array<Counter, 256> prefixed_ops;
+    std::array<Counter, static_cast<size_t>(Region::Count)> regions;
+    size_t banks;
+    std::unique_ptr<Counter[]> rom; // bank << 14 | pc & 0x3fff
+    std::unique_ptr<Counter[]> ram; // 0x8000 on, external ram banks share theirs
+    std::unique_ptr<Node[]> nodes;
+    u32 node_count;
+    std::array<u32, max_depth + 1> stack; // node at each depth, the root at 0
+    size_t depth;
+    size_t lost; // calls past max_depth, not in the tree
+    u64 idle_cycles;
+
+    static Region region_of(u16 address) {
+        if (address < 0x4000) return Region::Rom0;
+        if (address < 0x8000) return Region::RomX;
+        if (address < 0xa000) return Region::Vram;
+        if (address < 0xc000) return Region::Sram;
+        if (address < 0xe000) return Region::Wram;
+        if (address < 0xfe00) return Region::Echo;
+        if (address < 0xfea0) return Region::Oam;
+        if (address < 0xff00) return Region::Unusable;
+        if (address < 0xff80) return Region::Io;
+        if (address < 0xffff) return Region::Hram;
+        return Region::Ie;
+    }
+
+    // banks only tell rom apart, the rest of the map is the same whatever is switched in
+    static u32 frame(u16 address, u16 bank) { return address < 0x8000 ? u32(bank) << 16 | address : address; }
+
+    static u32 rom_frame(size_t offset) {
+        u16 bank = offset >> 14;
+        return frame((bank ? 0x4000 : 0) | (offset & 0x3fff), bank);
+    }
+
+    void enter(u32 frame) {
+        if (depth == max_depth) { // a stack that never unwinds, keep it from growing forever
+            lost++;
+            return;
+        }
+        stack[depth + 1] = child(stack[depth], frame);
+        depth++;
+    }
+
+    // a full tree counts new stacks in their caller
+    u32 child(u32 parent, u32 frame) {
+        u32 n = nodes[parent].first_child;
+        while (n != none && nodes[n].frame != frame)
+            n = nodes[n].next_sibling;
+        if (n != none || node_count == max_nodes)
+            return n != none ? n : parent;
+
+        n = node_count++;
+        nodes[n] = {parent, frame, none, nodes[parent].first_child, 0};
+        nodes[parent].first_child = n;
+        return n;
+    }
+
+    static std::string hex(unsigned value, int digits) {
+        static constexpr char digit[] = "0123456789abcdef";
+        std::string s(digits, '0');
+        for (int i = digits - 1; i >= 0; i--, value >>= 4)
+            s[i] = digit[value & 0xf];
+        return s;
+    }
+
+    // bank:address, interrupts by their name
+    static std::string name(u32 frame) {
+        switch (frame) {
+            case idle_frame: return "idle";
+            case interrupt_frame | 0x40: return "vblank";
+            case interrupt_frame | 0x48: return "lcd";
+            case interrupt_frame | 0x50: return "timer";
+            case interrupt_frame | 0x58: return "serial";
+            case interrupt_frame | 0x60: return "joypad";
+            default: return hex(frame >> 16 & 0xff, 2) + ":" + hex(frame & 0xffff, 4);
+        }
+    }
+
+    static void table(std::ostream& out, const char* title, std::vector<Entry>& entries, u64 total, size_t top) {
+        size_t shown = std::min(top, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + shown, entries.end(),
+                          [](const Entry& a, const Entry& b) { return a.counter.cycles > b.counter.cycles; });
+
+        out << title << ":" << std::endl;
+        for (size_t i = 0; i < shown && entries[i].counter.count; i++) {
+            const Counter& c = entries[i].counter;
+            out << "  " << std::left << std::setw(10) << entries[i].name << std::right << std::setw(14)
+                << c.count << std::setw(16) << c.cycles << std::fixed << std::setprecision(2) << std::setw(8)
+                << (total ? 100.0 * c.cycles / total : 0.0) << "%" << std::defaultfloat << std::endl;
+        }
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+#include <cstring>
+#include <vector>
+#include "gameboy.hpp"
+
+// the last few seconds of save states, one per frame. every keyframe_interval frames the whole state
+// is kept, the frames in between only as their xor against that keyframe. both are run length
+// coded into a byte ring allocated up front, the oldest frames make room for new ones
+class Rewind {
+public:
+    static constexpr size_t keyframe_interval = 60;
+
+    explicit Rewind(GameBoy& gb, size_t seconds = 60, size_t arena_bytes = 8 << 20)
+        : gb(gb), entries(std::max<size_t>(1, seconds * FRAMERATE)), arena(arena_bytes),
+          state(words(gb.state_size())), key(state.size()), packed(2 * gb.state_size() + 16) {}
+
+    // call at the start of every frame
+    void push() {
+        gb.save_state(state.data(), bytes(state));
+
+        bool keyframe = !count || next_frame - newest().key >= keyframe_interval;
+        u64 key_frame = keyframe ? next_frame : newest().key;
+        if (!keyframe)
+            load_key(key_frame);
+
+        size_t length = encode(raw(state), keyframe ? nullptr : raw(key), gb.state_size(), packed.data());
+        if (keyframe) {
+            key = state;
+            key_in_buffer = next_frame;
+        }
+
+        if (!place(length)) { // bigger than the whole arena, history starts over
+            count = 0;
+            return;
+        }
+        if (!keyframe && !count) { // making room took its keyframe along
+            key_frame = next_frame;
+            length = encode(raw(state), nullptr, gb.state_size(), packed.data());
+            key = state;
+            key_in_buffer = next_frame;
+            if (!place(length))
+                return;
+        }
+
+        std::memcpy(arena.data() + tail, packed.data(), length);
+        entries[slot(next_frame)] = {tail, length, key_frame};
+        tail += length;
+        count++;
+        next_frame++;
+    }
+
+    // loads the newest frame kept and forgets it, so every call goes one frame further back
+    bool step_back() {
+        if (!count)
+            return false;
+
+        const Entry& entry = newest();
+        u64 frame = next_frame - 1;
+        if (entry.key == frame) {
+            load_key(frame);
+            gb.load_state(key.data(), bytes(key));
+        } else {
+            load_key(entry.key);
+            state = key;
+            decode(arena.data() + entry.offset, entry.length, raw(state));
+            gb.load_state(state.data(), bytes(state));
+        }
+
+        tail = entry.offset;
+        count--;
+        next_frame--;
+        return true;
+    }
+
+    size_t frames() const { return count; }
+
+    // arena bytes taken by the frames kept
+    size_t memory_used() const {
+        if (!count)
+            return 0;
+        size_t first = entries[slot(next_frame - count)].offset;
+        return first < tail ? tail - first : arena.size() - first + tail;
+    }
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t length;
+        u64 key; // frame number of its keyframe, its own for keyframes
+    };
+
+    GameBoy& gb;
+    std::vector<Entry> entries; // indexed by frame number modulo size
+    std::vector<u8> arena;
+    std::vector<u64> state; // u64 so they are aligned for GameBoy::State
+    std::vector<u64> key;
+    std::vector<u8> packed;
+    size_t count = 0;
+    size_t tail = 0; // where the next frame goes in arena
+    u64 next_frame = 0;
+    u64 key_in_buffer = ~u64(0);
+
+    static size_t words(size_t bytes) { return (bytes + 7) / 8; }
+    static size_t bytes(const std::vector<u64>& v) { return v.size() * 8; }
+    static u8* raw(std::vector<u64>& v) { return reinterpret_cast<u8*>(v.data()); }
+
+    size_t slot(u64 frame) const { return frame % entries.size(); }
+    const Entry& newest() const { return entries[slot(next_frame - 1)]; }
+    const Entry& oldest() const { return entries[slot(next_frame - count)]; }
+
+    void load_key(u64 frame) {
+        if (key_in_buffer == frame)
+            return;
+
+        const Entry& entry = entries[slot(frame)];
+        std::fill(key.begin(), key.end(), 0);
+        decode(arena.data() + entry.offset, entry.length, raw(key));
+        key_in_buffer = frame;
+    }
+
+    // frees length bytes at tail, dropping the oldest frames in the way. frames whose keyframe
+    // went are useless and go as well
+    bool place(size_t length) {
+        if (length > arena.size())
+            return false;
+        if (tail + length > arena.size()) { // wraps, the oldest frames between tail and the end go first
+            while (count && oldest().offset >= tail)
+                count--;
+            tail = 0;
+        }
+
+        auto overlaps = [&](const Entry& e) { return e.offset < tail + length && tail < e.offset + e.length; };
+        while (count && (count == entries.size() || overlaps(oldest())))
+            count--;
+        while (count && oldest().key != next_frame - count)
+            count--;
+
+        if (!count) // everything went, keyframes start again
+            tail = 0;
+        return true;
+    }
+
+    static u8* put_varint(u8* out, size_t v) {
+        for (; v >= 0x80; v >>= 7)
+            *out++ = u8(v) | 0x80;
+        *out++ = u8(v);
+        return out;
+    }
+
+    static const u8* get_varint(const u8* in, size_t& v) {
+        v = 0;
+        for (int shift = 0;; shift += 7) {
+            u8 b = *in++;
+            v |= size_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return in;
+        }
+    }
+
+    // cur ^ ref as (zero run, literal length, literal bytes) triples, ref nullptr for plain cur.
+    // literals only end at 4 zero bytes, shorter gaps are cheaper to copy than to code
+    static size_t encode(const u8* cur, const u8* ref, size_t n, u8* out) {
+        auto delta = [&](size_t i) -> u8 { return ref ? cur[i] ^ ref[i] : cur[i]; };
+        u8* start = out;
+
+        for (size_t i = 0; i < n;) {
+            size_t run = i;
+            for (; run + 8 <= n; run += 8) { // skip equal words first
+                u64 a, b = 0;
+                std::memcpy(&a, cur + run, 8);
+                if (ref)
+                    std::memcpy(&b, ref + run, 8);
+                if (a != b)
+                    break;
+            }
+            while (run < n && !delta(run))
+                run++;
+            if (run == n)
+                break;
+
+            size_t end = run, zeros = 0;
+            for (; end < n && zeros < 4; end++)
+                zeros = delta(end) ? 0 : zeros + 1;
+            end -= zeros;
+
+            out = put_varint(out, run - i);
+            out = put_varint(out, end - run);
+            for (size_t j = run; j < end; j++)
+                *out++ = delta(j);
+            i = end;
+        }
+
+        return out - start;
+    }
+
+    // xors the coded delta into out
+    static void decode(const u8* in, size_t length, u8* out) {
+        const u8* end = in + length;
+        while (in < end) {
+            size_t run, literal;
+            in = get_varint(in, run);
+            in = get_varint(in, literal);
+            out += run;
+            for (size_t j = 0; j < literal; j++)
+                *out++ ^= *in++;
+        }
+    }
+};
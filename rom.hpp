@@ -0,0 +1,71 @@
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a rom file mapped read only. open() hands out one shared image per file, so any number of
+// cartridges running the same game share the same pages
+class RomImage {
+public:
+    static std::shared_ptr<const RomImage> open(const std::string& filepath) {
+        struct stat st{};
+        if (stat(filepath.c_str(), &st) != 0)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+
+        static std::mutex mutex;
+        static std::map<std::pair<dev_t, ino_t>, std::weak_ptr<const RomImage>> images;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& image = images[{st.st_dev, st.st_ino}];
+        if (auto shared = image.lock())
+            return shared;
+
+        auto shared = std::shared_ptr<const RomImage>(new RomImage(filepath));
+        image = shared;
+        return shared;
+    }
+
+    ~RomImage() {
+        if (bytes)
+            munmap(const_cast<u8*>(bytes), length);
+    }
+
+    RomImage(const RomImage&) = delete;
+    RomImage& operator=(const RomImage&) = delete;
+
+    const u8* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const u8* bytes = nullptr;
+    size_t length = 0;
+
+    explicit RomImage(const std::string& filepath) {
+        int fd = ::open(filepath.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { // nothing to map for an empty file
+            ::close(fd);
+            return;
+        }
+
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+
+        bytes = static_cast<const u8*>(p);
+        length = st.st_size;
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include "gameboy.hpp"
+
+// hides depth frames of input lag: each host frame runs the real frame, snapshots, runs depth
+// frames ahead with the same input, shows the last of them and goes back to the snapshot. only
+// that last frame is drawn and the frames ahead send nothing over serial
+class RunAhead {
+public:
+    explicit RunAhead(GameBoy& gb, size_t depth = 1) : gb(gb), depth(depth), state((gb.state_size() + 7) / 8) {}
+
+    void set_depth(size_t frames) { depth = frames; }
+    size_t frames_ahead() const { return depth; }
+
+    // one host frame with buttons (Joypad::Button mask) held
+    void run_frame(u8 buttons) {
+        gb.joypad.set(buttons);
+        if (!depth) {
+            gb.run(CYCLES_PER_FRAME);
+            return;
+        }
+
+        gb.ppu.set_render(false);
+        gb.run(CYCLES_PER_FRAME);
+        gb.save_state(state.data(), state.size() * 8);
+
+        SerialSink* sink = gb.serial.current_sink();
+        gb.serial.set_sink(nullptr);
+        for (size_t i = 1; i < depth; i++)
+            gb.run(CYCLES_PER_FRAME);
+        gb.ppu.set_render(true);
+        gb.run(CYCLES_PER_FRAME);
+        gb.serial.set_sink(sink);
+
+        gb.load_state(state.data(), state.size() * 8);
+    }
+
+private:
+    GameBoy& gb;
+    size_t depth;
+    std::vector<u64> state; // u64 so it is aligned for GameBoy::State
+};
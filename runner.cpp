@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "gbemuz.hpp"
+
+// gbemuz-runner <directory> [seconds]
+// runs every rom below directory in its own instance, in parallel, up to seconds of emulated time
+// each (60 by default). blargg roms report over serial in text, mooneye roms send 3 5 8 13 21 34
+// for a pass and 0x42s for a failure
+
+namespace {
+
+enum class Outcome { Pass, Fail, Timeout, Error };
+
+struct Result {
+    std::string rom;
+    Outcome outcome = Outcome::Timeout;
+    u64 cycles = 0;
+    u64 skipped = 0;
+    double seconds = 0;
+    std::string output;
+};
+
+// looks at the serial output so far
+Outcome judge(const std::string& output) {
+    static const std::string fibonacci = {3, 5, 8, 13, 21, 34};
+    static const std::string failure(6, 0x42);
+
+    if (output.find("Passed") != std::string::npos || output.find(fibonacci) != std::string::npos)
+        return Outcome::Pass;
+    if (output.find("Failed") != std::string::npos || output.find(failure) != std::string::npos)
+        return Outcome::Fail;
+    return Outcome::Timeout;
+}
+
+void run(Result& result, u64 budget) {
+    auto start = std::chrono::steady_clock::now();
+    try {
+        GameBoy gb(RomImage::open(result.rom)); // no save files next to the test roms
+        gb.ppu.set_render(false);
+        StringSink output;
+        gb.serial.set_sink(&output);
+
+        // a tenth of a second at a time, so a verdict ends the run soon after it is printed
+        while (gb.scheduler.now < budget && result.outcome == Outcome::Timeout) {
+            size_t seen = output.str().size();
+            gb.run(std::min<u64>(CLOCK_FREQUENCY / 10, budget - gb.scheduler.now));
+            if (output.str().size() != seen)
+                result.outcome = judge(output.str());
+        }
+        result.output = output.str();
+
+        result.cycles = gb.scheduler.now;
+        result.skipped = gb.cpu.skipped_cycles();
+    } catch (const std::exception& e) {
+        result.outcome = Outcome::Error;
+        result.output = e.what();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+const char* name(Outcome outcome) {
+    switch (outcome) {
+        case Outcome::Pass: return "pass";
+        case Outcome::Fail: return "FAIL";
+        case Outcome::Timeout: return "TIMEOUT";
+        default: return "ERROR";
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <directory> [seconds]" << std::endl;
+        return 1;
+    }
+
+    namespace fs = std::filesystem;
+    std::vector<Result> results;
+    for (const auto& entry : fs::recursive_directory_iterator(argv[1])) {
+        auto extension = entry.path().extension();
+        if (entry.is_regular_file() && (extension == ".gb" || extension == ".gbc"))
+            results.emplace_back().rom = entry.path().string();
+    }
+    std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.rom < b.rom; });
+
+    u64 budget = static_cast<u64>((argc > 2 ? std::stod(argv[2]) : 60) * CLOCK_FREQUENCY);
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool;
+        for (Result& result : results)
+            pool.submit([&result, budget] { run(result, budget); });
+        pool.wait();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t width = 3;
+    for (const Result& result : results)
+        width = std::max(width, result.rom.size());
+
+    int passed = 0;
+    std::printf("%-*s  %-7s  %14s  %8s  %10s  %7s\n", int(width), "rom", "result", "cycles", "seconds",
+                "Mcycles/s", "skipped");
+    for (const Result& result : results) {
+        passed += result.outcome == Outcome::Pass;
+        std::printf("%-*s  %-7s  %14llu  %8.3f  %10.1f  %6.1f%%\n", int(width), result.rom.c_str(),
+                    name(result.outcome), static_cast<unsigned long long>(result.cycles), result.seconds,
+                    result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0,
+                    result.cycles ? 100.0 * result.skipped / result.cycles : 0.0);
+        if (result.outcome == Outcome::Error)
+            std::printf("    %s\n", result.output.c_str());
+    }
+    std::printf("%d/%zu passed in %.2f s\n", passed, results.size(), elapsed);
+
+    return passed == int(results.size()) ? 0 : 1;
+}
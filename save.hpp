@@ -0,0 +1,85 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// battery backed ram mapped from a .sav file. writes only set a dirty bit per os page, flush()
+// hands just those pages to msync
+class SaveFile {
+public:
+    SaveFile(const std::string& filepath, size_t size) : length(size) {
+        int fd = ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(fd, size) != 0)) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error(filepath + ": " + std::strerror(error));
+        }
+
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+
+        bytes = static_cast<u8*>(p);
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+
+    ~SaveFile() {
+        flush(true);
+        munmap(bytes, length);
+    }
+
+    SaveFile(const SaveFile&) = delete;
+    SaveFile& operator=(const SaveFile&) = delete;
+
+    u8* data() { return bytes; }
+    size_t size() const { return length; }
+
+    void write(size_t offset, u8 value) {
+        bytes[offset] = value;
+        mark(offset, 1);
+    }
+
+    // for bytes changed through data()
+    void mark(size_t offset, size_t count) {
+        for (size_t page = offset / page_size; page * page_size < offset + count; page++)
+            dirty |= u64(1) << (page % 64);
+    }
+
+    bool is_dirty() const { return dirty != 0; }
+
+    // sync = false only schedules the writeback, enough for the periodic flushes
+    void flush(bool sync) {
+        for (size_t page = 0; dirty; page++) {
+            if (!(dirty & (u64(1) << page)))
+                continue;
+
+            size_t first = page;
+            while (page + 1 < 64 && (dirty & (u64(1) << (page + 1))))
+                page++;
+            for (size_t p = first; p <= page; p++)
+                dirty &= ~(u64(1) << p);
+
+            size_t offset = first * page_size;
+            if (offset < length)
+                msync(bytes + offset, std::min(length - offset, (page - first + 1) * page_size),
+                      sync ? MS_SYNC : MS_ASYNC);
+        }
+    }
+
+private:
+    u8* bytes = nullptr;
+    size_t length;
+    size_t page_size = 4096;
+    u64 dirty = 0; // one bit per os page, 128 KiB of ram fits in 32
+};
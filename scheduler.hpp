@@ -0,0 +1,138 @@
+#pragma once
+#include <array>
+#include <limits>
+
+enum class Event : u8 {
+    TimerOverflow,
+    LcdMode,
+    SerialTransfer,
+    DmaEnd,
+    SaveFlush,
+    Count,
+};
+
+// the system clock plus a min-heap of pending events. every event kind is pending at most once,
+// scheduling it again moves it
+class Scheduler {
+public:
+    static constexpr u64 never = std::numeric_limits<u64>::max();
+
+    u64 now = 0;
+
+    Scheduler() { position.fill(-1); }
+
+    // when the next event is due
+    u64 deadline() const { return size ? heap[0].when : never; }
+
+    void schedule(Event event, u64 when) {
+        int i = position[index(event)];
+        if (i < 0) {
+            i = size++;
+            heap[i] = {when, event};
+            position[index(event)] = i;
+            sift_up(i);
+            return;
+        }
+
+        bool earlier = when < heap[i].when;
+        heap[i].when = when;
+        if (earlier)
+            sift_up(i);
+        else
+            sift_down(i);
+    }
+
+    void schedule_in(Event event, u64 cycles) { schedule(event, now + cycles); }
+
+    void cancel(Event event) {
+        int i = position[index(event)];
+        if (i < 0)
+            return;
+
+        position[index(event)] = -1;
+        if (i == --size)
+            return;
+
+        Event moved = heap[size].event;
+        heap[i] = heap[size];
+        position[index(moved)] = i;
+        sift_up(i);
+        sift_down(position[index(moved)]);
+    }
+
+    bool pending(Event event) const { return position[index(event)] >= 0; }
+
+    u64 when(Event event) const {
+        int i = position[index(event)];
+        return i < 0 ? never : heap[i].when;
+    }
+
+private:
+    struct Entry {
+        u64 when;
+        Event event;
+    };
+
+    static constexpr size_t capacity = static_cast<size_t>(Event::Count);
+
+public:
+    // the heap as is, so events due at the same time still come out in the same order
+    struct State {
+        u64 now;
+        std::array<Entry, capacity> heap;
+        std::array<int, capacity> position;
+        int size;
+    };
+
+    void save(State& state) const { state = {now, heap, position, size}; }
+
+    void load(const State& state) {
+        now = state.now;
+        heap = state.heap;
+        position = state.position;
+        size = state.size;
+    }
+
+    // removes and returns the earliest event due at or before now, Event::Count if none
+    Event pop_due() {
+        if (!size || heap[0].when > now)
+            return Event::Count;
+
+        Event event = heap[0].event;
+        cancel(event);
+        return event;
+    }
+
+private:
+    std::array<Entry, capacity> heap{};
+    std::array<int, capacity> position{};
+    int size = 0;
+
+    static size_t index(Event event) { return static_cast<size_t>(event); }
+
+    void swap(int i, int j) {
+        std::swap(heap[i], heap[j]);
+        position[index(heap[i].event)] = i;
+        position[index(heap[j].event)] = j;
+    }
+
+    void sift_up(int i) {
+        while (i > 0 && heap[(i - 1) / 2].when > heap[i].when) {
+            swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(int i) {
+        while (true) {
+            int smallest = i;
+            for (int child = 2 * i + 1; child <= 2 * i + 2 && child < size; child++)
+                if (heap[child].when < heap[smallest].when)
+                    smallest = child;
+            if (smallest == i)
+                return;
+            swap(i, smallest);
+            i = smallest;
+        }
+    }
+};
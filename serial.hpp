@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include "mmu.hpp"
+#include "scheduler.hpp"
+
+// where the bytes sent out over serial end up
+class SerialSink {
+public:
+    virtual ~SerialSink() = default;
+    virtual void put(u8 byte) = 0;
+};
+
+class StringSink : public SerialSink {
+public:
+    void put(u8 byte) override { text += static_cast<char>(byte); }
+
+    const std::string& str() const { return text; }
+    void clear() { text.clear(); }
+
+private:
+    std::string text;
+};
+
+// flushed a line at a time
+class StreamSink : public SerialSink {
+public:
+    explicit StreamSink(std::ostream& out) : out(out) {}
+
+    void put(u8 byte) override {
+        out.put(static_cast<char>(byte));
+        if (byte == '\n')
+            out.flush();
+    }
+
+private:
+    std::ostream& out;
+};
+
+class FileSink : public SerialSink {
+public:
+    explicit FileSink(const std::string& filepath) : file(std::fopen(filepath.c_str(), "wb")) {
+        if (!file)
+            throw std::runtime_error(filepath + ": " + std::strerror(errno));
+    }
+
+    ~FileSink() override { std::fclose(file); }
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    void put(u8 byte) override { std::fputc(byte, file); }
+
+private:
+    std::FILE* file;
+};
+
+// single producer single consumer ring, for handing the bytes to another thread. the emulator
+// never waits, bytes that do not fit are counted and dropped
+class QueueSink : public SerialSink {
+public:
+    explicit QueueSink(size_t capacity = 4096) : mask(round_up(capacity) - 1), ring(new u8[mask + 1]) {}
+
+    void put(u8 byte) override {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring[t & mask] = byte;
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    // from the consumer thread, false when empty
+    bool pop(u8& byte) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        byte = ring[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    u64 dropped_bytes() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    size_t mask;
+    std::unique_ptr<u8[]> ring;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<u64> dropped{0};
+
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+};
+
+// the other end of a link cable, see link.hpp. called on the thread running this side
+class SerialLink {
+public:
+    virtual ~SerialLink() = default;
+
+    // this side is, or stopped, waiting on the external clock with out to send
+    virtual void external(bool waiting, u8 out) = 0;
+
+    // this side clocked out a byte on its internal clock, returns the one that came in
+    virtual u8 exchange(u8 out) = 0;
+};
+
+// ff01 / ff02. a transfer on the internal clock takes 8 bits at 8192 Hz and is one event, nothing
+// runs while the port is idle. on the external clock it waits for the other end of a link, if any
+class Serial : public IoDevice {
+public:
+    static constexpr u64 transfer_cycles = 8 * (CLOCK_FREQUENCY / 8192);
+
+    Serial(MMU& mmu, Scheduler& scheduler) : mmu(mmu), scheduler(scheduler) {
+        mmu.attach(*this, 0xff01, 0xff02);
+    }
+
+    // not owned, nullptr throws the bytes away
+    void set_sink(SerialSink* s) { sink = s; }
+    SerialSink* current_sink() const { return sink; }
+
+    // not owned, nullptr for no cable
+    void connect(SerialLink* l) { link = l; }
+
+    u8 io_read(u16 address) override {
+        return address == 0xff01 ? sb : sc | 0x7e;
+    }
+
+    void io_write(u16 address, u8 value) override {
+        if (address == 0xff01)
+            sb = value;
+        else
+            sc = value;
+
+        if (address == 0xff02 && (sc & 0x81) == 0x81)
+            scheduler.schedule_in(Event::SerialTransfer, transfer_cycles);
+        else if (address == 0xff02)
+            scheduler.cancel(Event::SerialTransfer);
+
+        if (link)
+            link->external((sc & 0x81) == 0x80, sb);
+    }
+
+    struct State {
+        u8 sb;
+        u8 sc;
+    };
+
+    void save(State& state) const { state = {sb, sc}; }
+
+    void load(const State& state) {
+        sb = state.sb;
+        sc = state.sc;
+    }
+
+    // Event::SerialTransfer
+    void transfer_complete() {
+        u8 in = link ? link->exchange(sb) : 0xff; // nobody on the other end
+        finish(in);
+    }
+
+    // the other end clocked a byte in while this side waited on the external clock
+    void receive(u8 in) {
+        if ((sc & 0x81) == 0x80)
+            finish(in);
+    }
+
+private:
+    MMU& mmu;
+    Scheduler& scheduler;
+    SerialSink* sink = nullptr;
+    SerialLink* link = nullptr;
+    u8 sb = 0;
+    u8 sc = 0;
+
+    void finish(u8 in) {
+        if (sink)
+            sink->put(sb);
+
+        sb = in;
+        sc &= 0x7f;
+        mmu.request_interrupt(Interrupt::Serial);
+    }
+};
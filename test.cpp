@@ -0,0 +1,886 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gbemuz.hpp"
+
+// gbemuz-test [case...], all of them when none is named. ctest runs each case on its own
+
+namespace {
+
+bool expect(bool ok, const std::string& what) {
+    if (!ok)
+        std::cerr << "  failed: " << what << std::endl;
+    return ok;
+}
+
+// a 32k rom only cartridge with code at 0x100 on, written out for RomImage to map
+struct TestRom {
+    std::vector<u8> bytes = std::vector<u8>(0x8000);
+
+    void put(u16 address, std::initializer_list<u8> code) {
+        for (u8 b : code)
+            bytes[address++] = b;
+    }
+
+    std::string write(const std::string& name) const {
+        auto path = std::filesystem::temp_directory_path() / ("gbemuz-test-" + name + ".gb");
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        return path.string();
+    }
+};
+
+// banks 16k banks, each starting with its number, low byte first
+TestRom banked(u8 type, u8 ram, size_t banks) {
+    TestRom rom;
+    rom.bytes.resize(banks * 0x4000);
+    for (size_t bank = 0; bank < banks; bank++) {
+        rom.bytes[bank * 0x4000] = bank & 0xff;
+        rom.bytes[bank * 0x4000 + 1] = bank >> 8;
+    }
+    rom.bytes[0x147] = type;
+    rom.bytes[0x149] = ram;
+    return rom;
+}
+
+u16 bank_at(GameBoy& gb, u16 address) { return gb.mmu.read(address) | gb.mmu.read(address + 1) << 8; }
+
+// the bank registers of each controller, as the cpu sees them through the mmu
+bool mbc() {
+    bool ok = true;
+    { // mbc1, 2 MiB and 32k of ram
+        GameBoy gb(RomImage::open(banked(0x02, 0x03, 128).write("mbc1")));
+        gb.mmu.write(0x0000, 0x0a);
+        gb.mmu.write(0x2000, 0x00);
+        ok &= expect(bank_at(gb, 0x4000) == 1, "mbc1: bank 0 selects 1");
+        for (u8 high : {1, 2, 3}) {
+            gb.mmu.write(0x4000, high);
+            ok &= expect(bank_at(gb, 0x4000) == 0x20 * high + 1,
+                         "mbc1: bank " + std::to_string(0x20 * high) + " selects the one after it");
+        }
+        gb.mmu.write(0x2000, 0x05);
+        ok &= expect(bank_at(gb, 0x4000) == 0x65, "mbc1: high and low bits together");
+        ok &= expect(bank_at(gb, 0x0000) == 0, "mbc1: bank 0 at 0x0000 in simple mode");
+
+        gb.mmu.write(0x4000, 0x00);
+        gb.mmu.write(0xa000, 0x10); // ram bank 0
+        gb.mmu.write(0x6000, 0x01);
+        gb.mmu.write(0x4000, 0x02);
+        ok &= expect(bank_at(gb, 0x0000) == 0x40, "mbc1: advanced mode moves 0x0000 to bank 0x40");
+        ok &= expect(bank_at(gb, 0x4000) == 0x45, "mbc1: and keeps 0x4000 where it was");
+        gb.mmu.write(0xa000, 0x12); // ram bank 2
+        ok &= expect(gb.mmu.read(0xa000) == 0x12, "mbc1: advanced mode banks ram");
+        gb.mmu.write(0x6000, 0x00);
+        ok &= expect(gb.mmu.read(0xa000) == 0x10, "mbc1: simple mode is back at ram bank 0");
+        ok &= expect(bank_at(gb, 0x0000) == 0, "mbc1: and rom bank 0 at 0x0000");
+        gb.mmu.write(0x6000, 0x01);
+        ok &= expect(gb.mmu.read(0xa000) == 0x12, "mbc1: ram bank 2 kept its byte");
+    }
+    { // mbc3 with the rtc, 32k of ram
+        GameBoy gb(RomImage::open(banked(0x10, 0x03, 64).write("mbc3")));
+        gb.mmu.write(0x0000, 0x0a);
+        gb.mmu.write(0x2000, 0x00);
+        ok &= expect(bank_at(gb, 0x4000) == 1, "mbc3: bank 0 selects 1");
+        gb.mmu.write(0x2000, 0x3f);
+        ok &= expect(bank_at(gb, 0x4000) == 0x3f, "mbc3: 7 bit bank");
+
+        for (u8 bank = 0; bank < 4; bank++) {
+            gb.mmu.write(0x4000, bank);
+            gb.mmu.write(0xa000, 0x10 + bank);
+        }
+        gb.mmu.write(0x4000, 0x0a); // hours
+        gb.mmu.write(0xa000, 0x05);
+        gb.mmu.write(0x6000, 0x00);
+        gb.mmu.write(0x6000, 0x01);
+        ok &= expect(gb.mmu.read(0xa000) == 0x05, "mbc3: 0x0a selects the hours");
+        for (u8 bank = 0; bank < 4; bank++) {
+            gb.mmu.write(0x4000, bank);
+            ok &= expect(gb.mmu.read(0xa000) == 0x10 + bank, "mbc3: ram bank " + std::to_string(bank)
+                                                                 + " untouched by the rtc");
+        }
+    }
+    { // mbc5, 8 MiB
+        GameBoy gb(RomImage::open(banked(0x19, 0x00, 512).write("mbc5")));
+        gb.mmu.write(0x2000, 0x00);
+        ok &= expect(bank_at(gb, 0x4000) == 0, "mbc5: bank 0 can be selected");
+        gb.mmu.write(0x2000, 0x05);
+        gb.mmu.write(0x3000, 0x01);
+        ok &= expect(bank_at(gb, 0x4000) == 0x105, "mbc5: 9th bit");
+        gb.mmu.write(0x2000, 0xff);
+        ok &= expect(bank_at(gb, 0x4000) == 0x1ff, "mbc5: low byte keeps the 9th bit");
+        gb.mmu.write(0x3000, 0x00);
+        ok &= expect(bank_at(gb, 0x4000) == 0xff, "mbc5: 9th bit off");
+    }
+    { // mbc5, 512k
+        GameBoy gb(RomImage::open(banked(0x19, 0x00, 32).write("mbc5-small")));
+        gb.mmu.write(0x2000, 0x25);
+        ok &= expect(bank_at(gb, 0x4000) == 0x05, "mbc5: bank 0x25 of 32 wraps to 5");
+        gb.mmu.write(0x3000, 0x01);
+        gb.mmu.write(0x2000, 0x03);
+        ok &= expect(bank_at(gb, 0x4000) == 0x03, "mbc5: bank 0x103 of 32 wraps to 3");
+    }
+    return ok;
+}
+
+// tasks that split into tasks and wait on them, two levels deep, more of them than workers: the
+// waiting ones run what they wait on, none of it may be left behind or hang the pool
+bool pool() {
+    bool ok = true;
+    for (size_t threads : {1, 2, 4}) {
+        ThreadPool pool(threads);
+        std::string name = std::to_string(threads) + " threads";
+        std::atomic<int> leaves{0};
+        std::atomic<int> complete{0}; // tasks that saw all their own follow-ups done
+        ThreadPool::Group outer;
+        for (int i = 0; i < 16; i++) {
+            pool.submit(outer, [&] {
+                std::atomic<int> done{0};
+                ThreadPool::Group inner;
+                for (int j = 0; j < 8; j++) {
+                    pool.submit(inner, [&] {
+                        std::atomic<int> below{0};
+                        ThreadPool::Group group;
+                        for (int k = 0; k < 4; k++)
+                            pool.submit(group, [&] {
+                                below++;
+                                leaves++;
+                            });
+                        pool.wait(group);
+                        complete += below == 4;
+                        done++;
+                    });
+                }
+                pool.wait(inner);
+                complete += done == 8;
+            });
+        }
+        pool.wait(outer);
+        ok &= expect(leaves == 16 * 8 * 4, name + ": every leaf ran");
+        ok &= expect(complete == 16 * 8 + 16, name + ": every wait saw its own tasks done");
+
+        std::atomic<int> more{0};
+        for (int i = 0; i < 100; i++)
+            pool.submit([&] { more++; });
+        pool.wait();
+        ok &= expect(more == 100, name + ": waiting on the whole pool after");
+    }
+    return ok;
+}
+
+// a program printing over serial with nobody on the other end, into a queue nobody empties: what
+// fits comes out in order, the rest is counted and dropped. and the ring going around many times
+bool queue_sink() {
+    TestRom rom;
+    rom.put(0x100, {0xc3, 0x50, 0x01});
+    rom.put(0x150, {
+        0x21, 0x00, 0x02, // ld hl, 0x200
+        0x2a, 0xb7, 0x28, 0x0e, // next byte, done at 0
+        0xe0, 0x01, 0x3e, 0x81, 0xe0, 0x02, // send it on the internal clock
+        0xf0, 0x02, 0xcb, 0x7f, 0x20, 0xfa, // wait for it to go
+        0x18, 0xee, // next
+        0x18, 0xfe,
+    });
+    rom.put(0x200, {'h', 'e', 'l', 'l', 'o', 0});
+    std::string path = rom.write("queue-sink");
+
+    bool ok = true;
+    GameBoy gb(RomImage::open(path));
+    QueueSink queue(3); // rounded up to 4
+    gb.serial.set_sink(&queue);
+    gb.run(u64(CYCLES_PER_FRAME));
+
+    std::string out;
+    for (u8 byte; queue.pop(byte);)
+        out += static_cast<char>(byte);
+    ok &= expect(out == "hell", "the first 4 bytes in order, got \"" + out + "\"");
+    ok &= expect(queue.dropped_bytes() == 1, "the 5th dropped");
+
+    QueueSink ring(8);
+    u8 next = 0;
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 5 + round % 4; i++)
+            ring.put(next + i);
+        for (u8 byte; ring.pop(byte); next++)
+            ok &= expect(byte == next, "round " + std::to_string(round) + ": in order");
+    }
+    ok &= expect(ring.dropped_bytes() == 0, "nothing dropped when it fits");
+    for (int i = 0; i < 12; i++)
+        ring.put(i);
+    ok &= expect(ring.dropped_bytes() == 4, "4 of 12 dropped into 8");
+    return ok;
+}
+
+// an instruction starting a block and running into the next page can not be part of it, the block
+// cache has to run it some other way instead of coming back to it forever
+bool page_crossing() {
+    TestRom rom;
+    rom.put(0x100, {0xc3, 0xff, 0x01}); // jp 0x1ff
+    rom.put(0x1ff, {0x3e, 0x0c}); // ld a, 0x0c
+    rom.put(0x201, {0x3c, 0x18, 0xfe}); // inc a, then jr to itself
+    std::string path = rom.write("page-crossing");
+
+    bool ok = true;
+    for (auto mode : {CPU::Mode::Interpreter, CPU::Mode::BlockCache, CPU::Mode::Jit}) {
+        GameBoy gb(RomImage::open(path), mode);
+        gb.run(u64(CYCLES_PER_FRAME));
+
+        CPU::State state;
+        gb.cpu.save(state);
+        std::string name = "mode " + std::to_string(static_cast<int>(mode));
+        ok &= expect(state.registers.a == 0x0d, name + ": a is 0x0d");
+        ok &= expect(state.registers.pc == 0x202, name + ": spinning at 0x202");
+    }
+    return ok;
+}
+
+// jr, jp, call and ret, each condition taken and not: where they go, the stack, and the cycles a
+// taken branch adds to the table's not taken ones
+bool branches() {
+    struct Branch {
+        const char* name;
+        u8 op;
+        u8 cycles; // not taken, or unconditional
+        u8 taken;
+        int stack; // sp change when taken
+    };
+    static constexpr Branch branches[] = {
+        {"jr cc", 0x20, 8, 12, 0},  {"jp cc", 0xc2, 12, 16, 0},  {"call cc", 0xc4, 12, 24, -2},
+        {"ret cc", 0xc0, 8, 20, 2}, {"jr", 0x18, 12, 12, 0},    {"jp", 0xc3, 16, 16, 0},
+        {"call", 0xcd, 24, 24, -2}, {"ret", 0xc9, 16, 16, 2},
+    };
+
+    TestRom rom;
+    rom.put(0x100, {0x18, 0xfe});
+    std::string path = rom.write("branches");
+
+    bool ok = true;
+    for (auto mode : {CPU::Mode::Interpreter, CPU::Mode::BlockCache}) {
+        GameBoy gb(RomImage::open(path), mode);
+        CPU::State state;
+        gb.cpu.save(state);
+        gb.mmu.write(0xdff0, 0x80); // what ret pops
+        gb.mmu.write(0xdff1, 0xc2);
+
+        for (const Branch& b : branches) {
+            bool conditional = b.cycles != b.taken;
+            for (int y = 0; y < (conditional ? 4 : 1); y++) { // nz z nc c
+                u8 op = b.op + 8 * y;
+                for (u8 f : {0x00, 0x10, 0x80, 0x90}) {
+                    bool flag = f & (y < 2 ? 0x80 : 0x10);
+                    bool taken = !conditional || flag == bool(y & 1);
+
+                    std::vector<u8> code = {op}; // in wram, going to 0xc280
+                    if (op == 0x18 || (op & 0xe7) == 0x20)
+                        code.push_back(static_cast<u8>(0xc280 - (0xc200 + 2)));
+                    else if (op == 0xc3 || op == 0xcd || (op & 0xe7) == 0xc2 || (op & 0xe7) == 0xc4)
+                        code.insert(code.end(), {0x80, 0xc2});
+                    for (size_t i = 0; i < code.size(); i++)
+                        gb.mmu.write(0xc200 + i, code[i]);
+
+                    CPU::State from = state;
+                    from.registers.pc = 0xc200;
+                    from.registers.f = f;
+                    from.registers.sp = 0xdff0;
+                    gb.cpu.load(from);
+                    size_t cycles = gb.cpu.step();
+
+                    CPU::State to;
+                    gb.cpu.save(to);
+                    u16 next = 0xc200 + code.size();
+                    std::string name = std::string(b.name) + " " + std::to_string(y) + " f " + std::to_string(f)
+                                       + " mode " + std::to_string(static_cast<int>(mode));
+                    ok &= expect(to.registers.pc == (taken ? 0xc280 : next), name + ": pc");
+                    ok &= expect(to.registers.sp == 0xdff0 + (taken ? b.stack : 0), name + ": sp");
+                    ok &= expect(cycles == (taken ? b.taken : b.cycles), name + ": cycles");
+                    if (taken && b.stack < 0) {
+                        u16 pushed = gb.mmu.read(0xdfee) | gb.mmu.read(0xdfef) << 8;
+                        ok &= expect(pushed == next, name + ": return address");
+                        gb.mmu.write(0xdfee, 0);
+                    }
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// reads the mbc3 rtc seconds register through a latch
+u8 rtc_seconds(GameBoy& gb) {
+    gb.mmu.write(0x6000, 0);
+    gb.mmu.write(0x6000, 1);
+    gb.mmu.write(0x4000, 0x08);
+    return gb.mmu.read(0xa000);
+}
+
+// the rtc follows emulated time: a state brings back the time it was saved at, and a battery save
+// keeps it from one run to the next
+bool rtc() {
+    TestRom rom;
+    rom.bytes[0x147] = 0x10; // mbc3, timer, ram, battery
+    rom.bytes[0x149] = 0x02;
+    rom.put(0x100, {0x18, 0xfe}); // jr to itself
+    std::string path = rom.write("rtc");
+    std::filesystem::remove(std::filesystem::path(path).replace_extension(".sav"));
+
+    bool ok = true;
+    {
+        GameBoy gb(path);
+        gb.mmu.write(0x0000, 0x0a); // ram and rtc on
+        gb.run(3 * CLOCK_FREQUENCY + 1000);
+        ok &= expect(rtc_seconds(gb) == 3, "3 s after power on");
+
+        std::vector<u64> state((gb.state_size() + sizeof(u64) - 1) / sizeof(u64)); // aligned for State
+        void* buffer = state.data();
+        ok &= expect(gb.save_state(buffer, gb.state_size()), "state saved");
+        gb.run(4 * CLOCK_FREQUENCY);
+        ok &= expect(rtc_seconds(gb) == 7, "7 s after power on");
+        ok &= expect(gb.load_state(buffer, gb.state_size()), "state loaded");
+        ok &= expect(rtc_seconds(gb) == 3, "back at 3 s with the state");
+        gb.run(2 * CLOCK_FREQUENCY);
+    }
+    {
+        GameBoy gb(path);
+        gb.mmu.write(0x0000, 0x0a);
+        u8 seconds = rtc_seconds(gb);
+        ok &= expect(seconds >= 5 && seconds < 10, "5 s from the save file, and whatever the host took");
+    }
+    std::filesystem::remove(std::filesystem::path(path).replace_extension(".sav"));
+    return ok;
+}
+
+// what a frame of rewind has to bring back exactly
+struct Snapshot {
+    u64 now;
+    Registers registers;
+    std::array<u8, 0x2000> wram;
+
+    explicit Snapshot(const GameBoy& gb) : now(gb.scheduler.now) {
+        CPU::State cpu;
+        gb.cpu.save(cpu);
+        registers = cpu.registers;
+        auto mmu = std::make_unique<MMU::State>();
+        gb.mmu.save(*mmu);
+        wram = mmu->wram;
+    }
+
+    bool operator==(const Snapshot& o) const {
+        return now == o.now && std::memcmp(&registers, &o.registers, sizeof registers) == 0 && wram == o.wram;
+    }
+};
+
+// with rendering off the ppu coasts through whole frames and works out ly and stat when they are
+// read. a program polling them, waiting in between, and taking vblank and lyc interrupts on every
+// other frame has to see the same thing at the same cycle either way
+bool render() {
+    TestRom rom;
+    rom.put(0x40, {0xc3, 0x00, 0x02});
+    rom.put(0x48, {0xc3, 0x20, 0x02});
+    rom.put(0x100, {0xc3, 0x50, 0x01});
+    rom.put(0x150, {
+        0x31, 0xfe, 0xdf, // ld sp, 0xdffe
+        0x3e, 0x03, 0xe0, 0xff, // vblank and stat on
+        0x3e, 0x40, 0xe0, 0x41, 0xaf, 0xe0, 0x45, 0xfb, // lyc interrupt at line 0, ei
+        0x21, 0x00, 0xc1, // ld hl, 0xc100
+        0xf0, 0x44, 0x22, 0xf0, 0x41, 0x22, // ly and stat into the log
+        0x06, 0x40, 0x05, 0x20, 0xfd, // wait a while
+        0x7c, 0xfe, 0xc2, 0x20, 0xf0, // 256 bytes of log
+        0x26, 0xc1, 0x18, 0xec, // and around again
+    });
+    rom.put(0x200, {
+        0xf5, 0xfa, 0x00, 0xc0, 0x3c, 0xea, 0x00, 0xc0, // count vblanks
+        0xf0, 0x41, 0xee, 0x40, 0xe0, 0x41, 0xf1, 0xd9, // lyc interrupt on and off, so every other frame coasts
+    });
+    rom.put(0x220, {0xf5, 0xf0, 0x45, 0xc6, 0x18, 0xfe, 0x90, 0x38, 0x01, 0xaf, 0xe0, 0x45, 0xf1, 0xd9}); // lyc += 24
+    std::string path = rom.write("render");
+
+    bool ok = true;
+    for (auto mode : {CPU::Mode::Interpreter, CPU::Mode::BlockCache}) {
+        GameBoy on(RomImage::open(path), mode);
+        GameBoy off(RomImage::open(path), mode);
+        off.ppu.set_render(false);
+
+        std::string name = "mode " + std::to_string(static_cast<int>(mode));
+        std::vector<std::pair<u16, u64>> interrupts[2]; // vector and cycle
+        u16 last[2] = {0, 0};
+        u64 end = on.scheduler.now + 60 * u64(CYCLES_PER_FRAME);
+        while (on.scheduler.now < end) {
+            GameBoy* both[] = {&on, &off};
+            for (int i = 0; i < 2; i++) {
+                both[i]->run(4);
+                CPU::State state;
+                both[i]->cpu.save(state);
+                u16 pc = state.registers.pc;
+                if ((pc == 0x40 || pc == 0x48) && pc != last[i])
+                    interrupts[i].emplace_back(pc, both[i]->scheduler.now);
+                last[i] = pc;
+            }
+            if (!expect(Snapshot(on) == Snapshot(off), name + ": same registers, memory and cycle at "
+                                                             + std::to_string(on.scheduler.now))) {
+                ok = false;
+                break;
+            }
+        }
+
+        auto count = [&](u16 vector) {
+            return std::count_if(interrupts[0].begin(), interrupts[0].end(), [&](auto& i) { return i.first == vector; });
+        };
+        ok &= expect(count(0x40) >= 59 && count(0x48) > 59, name + ": vblank and lyc interrupts taken");
+        ok &= expect(interrupts[0] == interrupts[1], name + ": interrupts at the same cycles");
+        ok &= expect(on.ppu.frames_drawn() > 0 && off.ppu.frames_drawn() == 0, name + ": only one of them drew");
+    }
+    return ok;
+}
+
+// two machines on a cable, one clocking 16 bytes out, the other sending back each complement on the
+// external clock. each logs what came in at 0xc100. two runs of the pair end up exactly the same
+bool link() {
+    TestRom master;
+    master.put(0x100, {0xc3, 0x50, 0x01});
+    master.put(0x150, {
+        0x31, 0xfe, 0xdf, 0x21, 0x00, 0xc1, 0x06, 0x00, // ld sp, 0xdffe  ld hl, 0xc100  ld b, 0
+        0x0e, 0x40, 0x0d, 0x20, 0xfd, // give the other side time to get ready
+        0x78, 0xe0, 0x01, 0x3e, 0x81, 0xe0, 0x02, // send b on the internal clock
+        0xf0, 0x02, 0xcb, 0x7f, 0x20, 0xfa, // wait for it to go
+        0xf0, 0x01, 0x22, 0x04, 0x78, 0xfe, 0x10, 0x20, 0xe5, // log what came back, 16 times
+        0x18, 0xfe,
+    });
+    TestRom slave;
+    slave.put(0x100, {0xc3, 0x50, 0x01});
+    slave.put(0x150, {
+        0x31, 0xfe, 0xdf, 0x21, 0x00, 0xc1, 0x06, 0x00, // ld sp, 0xdffe  ld hl, 0xc100  ld b, 0
+        0x78, 0x2f, 0xe0, 0x01, 0x3e, 0x80, 0xe0, 0x02, // ~b, waiting on the external clock
+        0xf0, 0x02, 0xcb, 0x7f, 0x20, 0xfa, // wait for it to go
+        0xf0, 0x01, 0x22, 0x04, 0x78, 0xfe, 0x10, 0x20, 0xe9, // log what came in, 16 times
+        0x18, 0xfe,
+    });
+    std::string master_path = master.write("link-master");
+    std::string slave_path = slave.write("link-slave");
+
+    bool ok = true;
+    std::vector<std::pair<Snapshot, Snapshot>> runs[2];
+    for (auto& frames : runs) {
+        GameBoy a(RomImage::open(master_path));
+        GameBoy b(RomImage::open(slave_path));
+        LinkCable cable(a, b);
+        for (int frame = 0; frame < 10; frame++) {
+            cable.run(u64(CYCLES_PER_FRAME));
+            frames.emplace_back(Snapshot(a), Snapshot(b));
+        }
+
+        for (u8 i = 0; i < 16; i++) {
+            ok &= expect(a.mmu.read(0xc100 + i) == u8(~i), "byte " + std::to_string(i) + " back to the master");
+            ok &= expect(b.mmu.read(0xc100 + i) == i, "byte " + std::to_string(i) + " over to the slave");
+        }
+        ok &= expect(cable.bytes_exchanged() == 32, "32 bytes across");
+    }
+    for (size_t frame = 0; frame < runs[0].size(); frame++)
+        ok &= expect(runs[0][frame] == runs[1][frame], "frame " + std::to_string(frame) + " the same both runs");
+    return ok;
+}
+
+// keyframes of very different sizes, so a new one often does not fit between tail and an older,
+// smaller one left at the end of the arena. every frame still kept has to step back to exactly what
+// it was
+bool rewind() {
+    TestRom rom;
+    rom.put(0x100, {0x18, 0xfe}); // jr to itself
+    std::string path = rom.write("rewind");
+
+    bool ok = true;
+    for (size_t arena = 4096; arena <= 65536; arena += 1024) {
+        GameBoy gb(RomImage::open(path));
+        Rewind rewind(gb, 60, arena);
+
+        u32 seed = 1;
+        auto random = [&] {
+            seed = seed * 1103515245 + 12345;
+            return u8(seed >> 16) | 1;
+        };
+        std::vector<Snapshot> snapshots;
+        for (int frame = 0; frame < 3000; frame++) {
+            if (frame % Rewind::keyframe_interval == 0) { // 0 to 4k of noise for the keyframe
+                size_t noise = random() % 5 * 0x400;
+                for (u16 i = 0; i < 0x1000; i++)
+                    gb.mmu.write(0xc000 + i, i < noise ? random() : 0);
+            }
+            for (int i = 0; i < frame % 13 * 8; i++) // and deltas of all sizes
+                gb.mmu.write(0xd000 + i, random());
+
+            snapshots.emplace_back(gb);
+            rewind.push();
+        }
+
+        std::string name = "arena " + std::to_string(arena);
+        ok &= expect(rewind.memory_used() <= arena, name + ": within the arena");
+        for (size_t back = 1; rewind.frames(); back++) {
+            rewind.step_back();
+            if (!expect(Snapshot(gb) == snapshots[snapshots.size() - back], name + ": frame " + std::to_string(back)
+                                                                             + " back is what it was")) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+// random tiles, maps, sprites and registers, held for a whole frame: the scanline and fifo tiers
+// draw it the same, they only differ in the timing of registers changed mid line
+bool ppu_tiers() {
+    TestRom rom;
+    rom.put(0x100, {0x18, 0xfe}); // jr to itself
+    std::string path = rom.write("ppu-tiers");
+
+    bool ok = true;
+    GameBoy scanline(RomImage::open(path), CPU::Mode::BlockCache, PPU::Accuracy::Scanline);
+    GameBoy fifo(RomImage::open(path), CPU::Mode::BlockCache, PPU::Accuracy::Fifo);
+    std::mt19937 rng(1);
+    for (int scene = 0; scene < 200; scene++) {
+        auto write = [&](u16 address, u8 value) {
+            scanline.mmu.write(address, value);
+            fifo.mmu.write(address, value);
+        };
+        for (u16 address = 0x8000; address < 0xa000; address++)
+            write(address, rng());
+        for (u16 address = 0xfe00; address < 0xfea0; address++)
+            write(address, rng());
+        write(0xff40, rng() | 0x80); // lcd on, the rest random
+        for (u16 address : {0xff42, 0xff43, 0xff47, 0xff48, 0xff49, 0xff4a, 0xff4b})
+            write(address, rng());
+
+        for (GameBoy* gb : {&scanline, &fifo}) { // the frame the writes landed in, then a clean one
+            gb->run_until_drawn();
+            gb->run_until_drawn();
+        }
+        if (!expect(scanline.ppu.framebuffer() == fifo.ppu.framebuffer(),
+                    "scene " + std::to_string(scene) + ": same pixels from both tiers"))
+            ok = false;
+    }
+    return ok;
+}
+
+// the tile cache decodes a tile once, a write to its data has to show on the next frame
+bool tile_cache() {
+    TestRom rom;
+    rom.put(0x100, {0x18, 0xfe}); // jr to itself
+    std::string path = rom.write("tile-cache");
+
+    bool ok = true;
+    for (auto accuracy : {PPU::Accuracy::Scanline, PPU::Accuracy::Fifo}) {
+        GameBoy gb(RomImage::open(path), CPU::Mode::BlockCache, accuracy);
+        std::string name = accuracy == PPU::Accuracy::Fifo ? "fifo" : "scanline";
+        gb.mmu.write(0xff40, 0x91); // lcd and background on, tiles at 0x8000, map at 0x9800
+        gb.mmu.write(0xff42, 0);
+        gb.mmu.write(0xff43, 0);
+        gb.mmu.write(0xff47, 0xe4); // color numbers as they are
+        for (u16 address = 0x9800; address < 0x9c00; address++)
+            gb.mmu.write(address, 0x01);
+
+        for (u8 color = 0; color < 4; color++) {
+            for (u16 address = 0x8010; address < 0x8020; address += 2) { // all of tile 1 one color
+                gb.mmu.write(address, color & 1 ? 0xff : 0x00);
+                gb.mmu.write(address + 1, color & 2 ? 0xff : 0x00);
+            }
+            gb.run_until_drawn();
+            gb.run_until_drawn();
+
+            const auto& screen = gb.ppu.framebuffer();
+            u8 shade = screen[0];
+            bool even = std::all_of(screen.begin(), screen.end(), [&](u8 pixel) { return pixel == shade; });
+            ok &= expect(even, name + ": color " + std::to_string(color) + " all over");
+            ok &= expect(shade == color, name + ": color " + std::to_string(color) + " drawn, not the one before");
+        }
+        ok &= expect(gb.mmu.tile_cache().hits() > 0, name + ": tiles reused between writes");
+    }
+    return ok;
+}
+
+// halted, or polling ly in a loop of its own, the clock jumps to the next event instead of running
+// it out. either way a frame has to end where it ends with nothing skipped. the interpreter does
+// not find polling loops, only blocks do
+bool idle() {
+    TestRom halt;
+    halt.put(0x40, {0xfa, 0x00, 0xc0, 0x3c, 0xea, 0x00, 0xc0, 0xd9}); // count vblanks at 0xc000, reti
+    halt.put(0x100, {0xc3, 0x50, 0x01});
+    halt.put(0x150, {
+        0x31, 0xfe, 0xdf, // ld sp, 0xdffe
+        0x3e, 0x01, 0xe0, 0xff, 0xfb, // vblank on, ei
+        0x76, 0x18, 0xfd, // halt, and again
+    });
+
+    TestRom poll;
+    poll.put(0x100, {0xc3, 0x50, 0x01});
+    poll.put(0x150, {
+        0x31, 0xfe, 0xdf, // ld sp, 0xdffe
+        0xf0, 0x44, 0xfe, 0x90, 0x20, 0xfa, // wait for ly 144
+        0xfa, 0x00, 0xc0, 0x3c, 0xea, 0x00, 0xc0, // count it at 0xc000
+        0xf0, 0x44, 0xfe, 0x90, 0x28, 0xfa, // wait for ly to move on
+        0x18, 0xec, // and again
+    });
+
+    bool ok = true;
+    for (auto [name, rom] : {std::pair{"halt", &halt}, std::pair{"poll", &poll}}) {
+        std::string path = rom->write(std::string("idle-") + name);
+        for (auto mode : {CPU::Mode::Interpreter, CPU::Mode::BlockCache, CPU::Mode::Jit}) {
+            GameBoy skipping(RomImage::open(path), mode);
+            GameBoy running(RomImage::open(path), mode);
+            running.cpu.set_fast_forward(false);
+            for (int frame = 0; frame < 60; frame++) {
+                skipping.run(u64(CYCLES_PER_FRAME));
+                running.run(u64(CYCLES_PER_FRAME));
+            }
+
+            std::string what = std::string(name) + " mode " + std::to_string(static_cast<int>(mode));
+            bool skips = rom == &halt || mode != CPU::Mode::Interpreter;
+            ok &= expect((skipping.cpu.skipped_cycles() > 0) == skips,
+                         what + (skips ? ": cycles skipped" : ": nothing skipped"));
+            ok &= expect(running.cpu.skipped_cycles() == 0, what + ": nothing skipped with fast forward off");
+            ok &= expect(skipping.mmu.read(0xc000) >= 59, what + ": every vblank seen");
+            ok &= expect(Snapshot(skipping) == Snapshot(running), what + ": same state as running it out");
+        }
+    }
+    return ok;
+}
+
+// cpu, memory and ppu, everything a state brings back that shows
+struct Machine {
+    CPU::State cpu;
+    std::unique_ptr<MMU::State> mmu = std::make_unique<MMU::State>();
+    PPU::State ppu;
+    std::array<u8, PPU::width * PPU::height> screen;
+
+    explicit Machine(const GameBoy& gb) : screen(gb.ppu.framebuffer()) {
+        gb.cpu.save(cpu);
+        gb.mmu.save(*mmu);
+        gb.ppu.save(ppu);
+    }
+
+    // field by field, the states have padding
+    bool operator==(const Machine& o) const {
+        const auto& f = ppu.fifo;
+        const auto& g = o.ppu.fifo;
+        auto same = [](const auto& x, const auto& y) { return std::memcmp(&x, &y, sizeof x) == 0; };
+        return same(cpu.registers, o.cpu.registers) && cpu.halted == o.cpu.halted
+            && cpu.interrupt_enabled == o.cpu.interrupt_enabled && cpu.enable_interrupts == o.cpu.enable_interrupts
+            && same(*mmu, *o.mmu) && ppu.mode_end == o.ppu.mode_end && ppu.line_start == o.ppu.line_start
+            && ppu.frame_start == o.ppu.frame_start && ppu.frames == o.ppu.frames && ppu.mode == o.ppu.mode
+            && ppu.lcdc == o.ppu.lcdc && ppu.stat == o.ppu.stat && ppu.scy == o.ppu.scy && ppu.scx == o.ppu.scx
+            && ppu.ly == o.ppu.ly && ppu.lyc == o.ppu.lyc && ppu.bgp == o.ppu.bgp && ppu.obp0 == o.ppu.obp0
+            && ppu.obp1 == o.ppu.obp1 && ppu.wy == o.ppu.wy && ppu.wx == o.ppu.wx
+            && ppu.window_line == o.ppu.window_line && ppu.coarse == o.ppu.coarse
+            && ppu.draw_frame == o.ppu.draw_frame && ppu.forced_frame == o.ppu.forced_frame && f.dot == g.dot
+            && f.x == g.x && f.discard == g.discard && f.stall == g.stall && f.step == g.step
+            && f.fetch_x == g.fetch_x && f.tile == g.tile && f.window == g.window && f.done == g.done
+            && same(f.row, g.row) && same(f.bg, g.bg) && f.bg_next == g.bg_next && same(f.obj_color, g.obj_color)
+            && same(f.obj_attr, g.obj_attr) && same(f.sprites, g.sprites) && f.sprite_count == g.sprite_count
+            && f.next_sprite == g.next_sprite && screen == o.screen;
+    }
+};
+
+// a state taken mid run and loaded again, into the same machine or a new one, has to go on exactly
+// as it did the first time. one that does not fit is turned down with nothing changed
+bool save_state() {
+    auto rom = [](u8 ram) {
+        TestRom rom;
+        rom.bytes[0x147] = 0x02; // mbc1 and ram
+        rom.bytes[0x149] = ram;
+        rom.put(0x40, {
+            0xf5, 0xfa, 0x00, 0xc0, 0x3c, 0xea, 0x00, 0xc0, 0xe0, 0x43, // count vblanks, scroll by it
+            0xf0, 0x05, 0xea, 0x01, 0xc0, 0xf1, 0xd9, // keep tima
+        });
+        rom.put(0x100, {0xc3, 0x50, 0x01});
+        rom.put(0x150, {
+            0x31, 0xfe, 0xdf, // ld sp, 0xdffe
+            0x3e, 0x01, 0xe0, 0xff, 0x3e, 0x05, 0xe0, 0x07, 0xfb, // vblank on, timer on, ei
+            0x3e, 0x0a, 0xea, 0x00, 0x00, // cartridge ram on
+            0x21, 0x00, 0x80, // ld hl, 0x8000
+            0xfa, 0x00, 0xc0, 0xad, 0x22, // tile data from the count
+            0x7c, 0xfe, 0x98, 0x20, 0xf6, // up to 0x9800
+            0xea, 0x00, 0xa0, 0xc3, 0x61, 0x01, // count in cartridge ram too, and again
+        });
+        return rom;
+    };
+    std::string path = rom(0x02).write("save-state");
+
+    bool ok = true;
+    GameBoy gb(RomImage::open(path));
+    for (int frame = 0; frame < 10; frame++)
+        gb.run(u64(CYCLES_PER_FRAME));
+    std::vector<u64> state((gb.state_size() + sizeof(u64) - 1) / sizeof(u64)); // aligned for State
+    void* buffer = state.data();
+    ok &= expect(gb.save_state(buffer, gb.state_size()), "state saved");
+
+    for (int frame = 0; frame < 30; frame++)
+        gb.run(u64(CYCLES_PER_FRAME));
+    Machine first(gb);
+    ok &= expect(gb.load_state(buffer, gb.state_size()), "state loaded");
+    for (int frame = 0; frame < 30; frame++)
+        gb.run(u64(CYCLES_PER_FRAME));
+    ok &= expect(Machine(gb) == first, "30 frames from the state end where they did");
+
+    GameBoy other(RomImage::open(path));
+    ok &= expect(other.load_state(buffer, other.state_size()), "state loaded into another machine");
+    for (int frame = 0; frame < 30; frame++)
+        other.run(u64(CYCLES_PER_FRAME));
+    ok &= expect(Machine(other) == first, "and that one ends there too");
+
+    Machine before(gb);
+    std::vector<u64> changed = state;
+    reinterpret_cast<GameBoy::State*>(changed.data())->version++;
+    ok &= expect(!gb.load_state(changed.data(), gb.state_size()), "another version turned down");
+    ok &= expect(!gb.load_state(buffer, gb.state_size() - 1), "a short buffer turned down");
+    ok &= expect(!gb.load_state(buffer, sizeof(GameBoy::State) - 1), "a buffer short of the state turned down");
+    std::vector<u64> shifted(state.size() + 1);
+    void* misaligned = reinterpret_cast<u8*>(shifted.data()) + 1;
+    std::memcpy(misaligned, buffer, gb.state_size());
+    ok &= expect(!gb.load_state(misaligned, gb.state_size()), "a misaligned buffer turned down");
+    GameBoy larger(RomImage::open(rom(0x03).write("save-state-32k")));
+    ok &= expect(!larger.load_state(buffer, gb.state_size()), "another cartridge ram size turned down");
+    ok &= expect(Machine(gb) == before, "nothing changed by any of them");
+    return ok;
+}
+
+#if GBEMUZ_JIT
+// every instruction the translator handles on registers, each as a block of its own ending in a jr to
+// itself: translated code has to leave the registers, flags and cycle count the interpreter does
+bool jit() {
+    std::vector<std::vector<u8>> code;
+    for (int op = 0x40; op < 0x80; op++) // ld r, r'
+        if (op != 0x76 && (op & 7) != 6 && (op >> 3 & 7) != 6)
+            code.push_back({u8(op)});
+    for (int op = 0x80; op < 0xc0; op++) // alu a, r
+        if ((op & 7) != 6)
+            code.push_back({u8(op)});
+    for (int op = 0xc6; op < 0x100; op += 8) // alu a, n
+        for (u8 n : {0x00, 0x01, 0x0f, 0x10, 0x7f, 0x80, 0x99, 0xff})
+            code.push_back({u8(op), n});
+    for (int r = 0; r < 8; r++) // inc r, dec r
+        if (r != 6)
+            for (int op : {0x04, 0x05})
+                code.push_back({u8(op | r << 3)});
+    for (u8 op : {0x07, 0x0f, 0x17, 0x1f, 0x2f, 0x37, 0x3f}) // rotates on a, cpl, scf, ccf
+        code.push_back({op});
+    for (int op = 0; op < 0x100; op++) // rotates, shifts, bit, res and set on registers
+        if ((op & 7) != 6)
+            code.push_back({0xcb, u8(op)});
+
+    TestRom rom;
+    std::vector<u16> starts;
+    u16 address = 0x200;
+    for (const auto& c : code) {
+        if ((address + c.size() + 1) >> 8 != address >> 8) // blocks stop at the end of a page
+            address = (address | 0xff) + 1;
+        starts.push_back(address);
+        for (u8 b : c)
+            rom.bytes[address++] = b;
+        rom.put(address, {0x18, 0xfe}); // jr to itself
+        address += 2;
+    }
+    rom.put(0x100, {0x18, 0xfe});
+    std::string path = rom.write("jit");
+
+    GameBoy interpreted(RomImage::open(path), CPU::Mode::Interpreter);
+    GameBoy translated(RomImage::open(path), CPU::Mode::Jit);
+    CPU::State state;
+    translated.cpu.save(state);
+
+    auto run = [&](CPU& cpu, const CPU::State& from, size_t steps) {
+        cpu.load(from);
+        size_t cycles = 0;
+        for (size_t i = 0; i < steps; i++)
+            cycles += cpu.step();
+        return cycles;
+    };
+
+    for (u16 start : starts) { // hot enough to be translated
+        state.registers.pc = start;
+        for (u32 i = 0; i < 40; i++)
+            run(translated.cpu, state, 1);
+    }
+
+    bool ok = expect(translated.cpu.translated_blocks() == starts.size(), "every block translated");
+    ok &= expect(interpreted.cpu.code_memory() == 0, "no code memory for the interpreter");
+    static constexpr u8 values[] = {0x00, 0x01, 0x0f, 0x10, 0x7f, 0x80, 0x99, 0xff};
+    for (size_t i = 0; i < starts.size() && ok; i++) {
+        for (u8 a : values) {
+            for (u8 b : values) {
+                for (unsigned f = 0; f < 0x100; f += 0x10) {
+                    CPU::State from = state;
+                    from.registers.pc = starts[i];
+                    from.registers.af = a << 8 | f;
+                    from.registers.bc = b << 8 | u8(b ^ 0x5a);
+                    from.registers.de = u8(b + 1) << 8 | u8(~b);
+                    from.registers.hl = u8(b >> 1) << 8 | u8(a ^ b);
+
+                    size_t jit_cycles = run(translated.cpu, from, 1); // the jr comes along
+                    size_t cycles = run(interpreted.cpu, from, 2);
+                    CPU::State expected, got;
+                    interpreted.cpu.save(expected);
+                    translated.cpu.save(got);
+                    std::ostringstream name;
+                    name << std::hex << "op";
+                    for (u8 byte : code[i])
+                        name << " " << unsigned(byte);
+                    name << " a " << unsigned(a) << " b " << unsigned(b) << " f " << f;
+                    if (!expect(std::memcmp(&expected.registers, &got.registers, sizeof(Registers)) == 0,
+                                name.str() + ": registers and flags")
+                        || !expect(jit_cycles == cycles, name.str() + ": cycles"))
+                        return false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+#endif
+
+struct Case {
+    const char* name;
+    bool (*run)();
+};
+
+constexpr Case cases[] = {
+    {"branches", branches},
+    {"idle", idle},
+#if GBEMUZ_JIT
+    {"jit", jit},
+#endif
+    {"link", link},
+    {"mbc", mbc},
+    {"page_crossing", page_crossing},
+    {"pool", pool},
+    {"ppu_tiers", ppu_tiers},
+    {"queue_sink", queue_sink},
+    {"render", render},
+    {"rewind", rewind},
+    {"rtc", rtc},
+    {"save_state", save_state},
+    {"tile_cache", tile_cache},
+};
+
+}
+
+int main(int argc, char** argv) {
+    int failed = 0;
+    for (const Case& c : cases) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++)
+            selected |= std::strcmp(argv[i], c.name) == 0;
+        if (!selected)
+            continue;
+
+        bool ok = c.run();
+        std::cout << c.name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+        failed += !ok;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <array>
+#include <cstring>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// one 2bpp tile row, low and high bitplane, to eight color numbers 0-3, leftmost pixel first.
+// all eight at once, with pdep when built for bmi2, with sse2 compares otherwise
+inline void decode_tile_row(u8 low, u8 high, u8* out) {
+#if defined(__BMI2__)
+    u64 pixels = _pdep_u64(low, 0x0101010101010101) | _pdep_u64(high, 0x0202020202020202);
+    pixels = __builtin_bswap64(pixels); // bit 7 is the leftmost pixel, it goes to the lowest byte
+    std::memcpy(out, &pixels, 8);
+#elif defined(__SSE2__)
+    const __m128i bits = _mm_setr_epi8(char(0x80), 0x40, 0x20, 0x10, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i l = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(char(low)), bits), bits);
+    __m128i h = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(char(high)), bits), bits);
+    __m128i pixels = _mm_or_si128(_mm_and_si128(l, _mm_set1_epi8(1)), _mm_and_si128(h, _mm_set1_epi8(2)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), pixels);
+#else
+    static constexpr std::array<u64, 256> spread = [] {
+        std::array<u64, 256> t{};
+        for (int b = 0; b < 256; b++)
+            for (int i = 0; i < 8; i++)
+                if (b & (0x80 >> i))
+                    t[b] |= u64(1) << (8 * i);
+        return t;
+    }();
+    u64 pixels = spread[low] | spread[high] << 1; // little endian, byte 0 is the leftmost pixel
+    std::memcpy(out, &pixels, 8);
+#endif
+}
+
+// the 384 tiles of vram decoded to a byte per pixel. the mmu marks a tile dirty when its bytes
+// are written, it gets decoded again the next time the ppu asks for it
+class TileCache {
+public:
+    explicit TileCache(const std::array<u8, 0x2000>& vram) : vram(vram) { invalidate_all(); }
+
+    // vram offset written, 0 - 0x17ff
+    void invalidate(u16 offset) { dirty[offset / 16] = true; }
+    void invalidate_all() { dirty.fill(true); }
+
+    // eight color numbers of row y of tile, numbered as with the 0x8000 addressing
+    const u8* row(u16 tile, u8 y) {
+        if (dirty[tile]) {
+            for (int r = 0; r < 8; r++)
+                decode_tile_row(vram[tile * 16 + r * 2], vram[tile * 16 + r * 2 + 1], &pixels[tile][r * 8]);
+            dirty[tile] = false;
+            decoded++;
+        } else {
+            reused++;
+        }
+        return &pixels[tile][y * 8];
+    }
+
+    u64 hits() const { return reused; }
+    u64 misses() const { return decoded; }
+
+private:
+    const std::array<u8, 0x2000>& vram;
+    std::array<std::array<u8, 64>, 384> pixels{};
+    std::array<bool, 384> dirty{};
+    u64 reused = 0;
+    u64 decoded = 0;
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include "mmu.hpp"
+#include "scheduler.hpp"
+
+// div and tima are worked out from the clock when read, the only event is tima overflowing
+class Timer : public IoDevice {
+public:
+    Timer(MMU& mmu, Scheduler& scheduler) : mmu(mmu), scheduler(scheduler) {
+        mmu.attach(*this, 0xff04, 0xff07);
+    }
+
+    u8 io_read(u16 address) override {
+        switch (address) {
+            case 0xff04:
+                return static_cast<u8>(counter(scheduler.now) >> 8);
+            case 0xff05:
+                return static_cast<u8>(tima_value + ticks(tima_time, scheduler.now));
+            case 0xff06:
+                return tma;
+            default:
+                return tac | 0xf8;
+        }
+    }
+
+    void io_write(u16 address, u8 value) override {
+        sync();
+
+        switch (address) {
+            case 0xff04:
+                div_base = scheduler.now;
+                break;
+            case 0xff05:
+                tima_value = value;
+                break;
+            case 0xff06:
+                tma = value;
+                break;
+            default:
+                tac = value & 7;
+                break;
+        }
+
+        reschedule();
+    }
+
+    struct State {
+        u64 div_base;
+        u64 tima_time;
+        u32 tima_value;
+        u8 tma;
+        u8 tac;
+    };
+
+    void save(State& state) const { state = {div_base, tima_time, tima_value, tma, tac}; }
+
+    // the overflow event comes back with the scheduler
+    void load(const State& state) {
+        div_base = state.div_base;
+        tima_time = state.tima_time;
+        tima_value = state.tima_value;
+        tma = state.tma;
+        tac = state.tac;
+    }
+
+    // Event::TimerOverflow
+    void overflow() {
+        sync();
+        tima_value = tma + (tima_value - 0x100); // late by a few cycles at most
+        mmu.request_interrupt(Interrupt::Timer);
+        reschedule();
+    }
+
+private:
+    MMU& mmu;
+    Scheduler& scheduler;
+    u64 div_base = 0; // when div was last reset
+    u64 tima_time = 0; // tima was tima_value at this point
+    u32 tima_value = 0;
+    u8 tma = 0;
+    u8 tac = 0;
+
+    bool enabled() const { return tac & 4; }
+
+    // tima counts falling edges of bit 9, 3, 5 or 7 of the system counter
+    u8 shift() const {
+        static constexpr u8 shifts[] = {10, 4, 6, 8};
+        return shifts[tac & 3];
+    }
+
+    u64 counter(u64 time) const { return time - div_base; }
+
+    u32 ticks(u64 from, u64 to) const {
+        if (!enabled())
+            return 0;
+        return static_cast<u32>((counter(to) >> shift()) - (counter(from) >> shift()));
+    }
+
+    void sync() {
+        tima_value += ticks(tima_time, scheduler.now);
+        tima_time = scheduler.now;
+    }
+
+    void reschedule() {
+        if (!enabled()) {
+            scheduler.cancel(Event::TimerOverflow);
+            return;
+        }
+
+        if (tima_value > 0xff) { // already overflowed, the event just was not handled yet
+            scheduler.schedule(Event::TimerOverflow, scheduler.now);
+            return;
+        }
+
+        u64 period = u64(1) << shift();
+        u64 next_tick = div_base + (counter(tima_time) / period + 1) * period;
+        scheduler.schedule(Event::TimerOverflow, next_tick + (0xff - tima_value) * period);
+    }
+};